@@ -0,0 +1,178 @@
+// Shifts a large file up by a few bytes with the mover pbofile used before (copy<buffsize>)
+// and with rv::util::move_range, reporting the time taken and whether the data survived.
+//
+// Usage: copy_benchmark [<size in MiB> [<distance in bytes> [<directory>]]]
+#include "move_range.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace
+{
+    // Mover of pbofile before it moved data through a large buffer with positional I/O, kept as it was.
+    //
+    // Remarks:
+    // - If data overlaps, only half of buffsize is used
+    template<size_t buffsize>
+    void legacy_copy(std::fstream& file, std::streampos old_start, std::streampos old_end, std::streampos new_start)
+    {
+        if (old_start == new_start) { return; }
+        if (old_start == old_end) { return; }
+        // Get current position so we can seek back later
+        std::streampos cur = file.tellp();
+
+        // Check if new start intersects with old data
+        bool intersects = new_start >= old_start && old_end >= new_start;
+
+        // Seek to start
+        file.seekp(old_start, std::ios::beg);
+        std::streampos source_cur = old_start;
+        std::streampos target_cur = new_start;
+        char buff[buffsize];
+
+        if (intersects)
+        {
+            // Strategy:
+            //   Only ever copy half of the data,
+            //   read in other half ahead of time.
+            bool flip = false;
+            const size_t buffsize_half = buffsize / 2;
+
+            // Read in initial
+            size_t old_read_len = buffsize_half < size_t(old_end - source_cur) ? buffsize_half : size_t(old_end - source_cur);
+            file.seekg(source_cur);
+            file.read(buff, old_read_len);
+            file.clear();
+            source_cur = file.tellg();
+            flip = true;
+
+            while (source_cur < old_end)
+            {
+                auto remaining = old_end - source_cur;
+                auto read_len = buffsize_half < size_t(remaining) ? buffsize_half : size_t(remaining);
+
+                // Read in ahead, flipping the buffer part used each time
+                file.seekg(source_cur);
+                file.read(buff + ((flip ? 1 : 0) * buffsize_half), read_len);
+                file.clear();
+                source_cur = file.tellg();
+                flip = !flip;
+
+                // Write out current at end
+                file.seekp(target_cur);
+                file.write(buff + ((flip ? 1 : 0) * buffsize_half), old_read_len);
+                target_cur = file.tellp();
+
+                old_read_len = read_len;
+            }
+
+            // Write out last flip if needed
+            if (old_read_len > 0)
+            {
+                flip = !flip;
+                file.seekp(target_cur);
+                file.write(buff + ((flip ? 1 : 0) * buffsize_half), old_read_len);
+            }
+        }
+        else
+        {
+            while (source_cur < old_end)
+            {
+                auto remaining = old_end - source_cur;
+                auto read_len = buffsize < size_t(remaining) ? buffsize : size_t(remaining);
+
+                // Read in current
+                file.seekg(source_cur);
+                file.read(buff, read_len);
+                file.clear();
+                source_cur = file.tellg();
+
+                // Write out current at end
+                file.seekp(target_cur);
+                file.write(buff, read_len);
+                target_cur = file.tellp();
+            }
+        }
+
+        // Seek back to where we have been
+        file.seekp(cur);
+    }
+    char pattern(size_t offset)
+    {
+        return char((offset * 2654435761u) >> 13);
+    }
+    void create(const std::filesystem::path& path, size_t size)
+    {
+        std::ofstream file(path, std::ios_base::binary | std::ios_base::trunc);
+        std::vector<char> buffer(1024 * 1024);
+        for (size_t done = 0; done < size; done += buffer.size())
+        {
+            auto chunk = std::min(buffer.size(), size - done);
+            for (size_t i = 0; i < chunk; i++)
+            {
+                buffer[i] = pattern(done + i);
+            }
+            file.write(buffer.data(), std::streamsize(chunk));
+        }
+    }
+    // Whether the original data of size bytes is found at distance.
+    bool shifted(const std::filesystem::path& path, size_t size, size_t distance)
+    {
+        std::ifstream file(path, std::ios_base::binary);
+        file.seekg(std::streamoff(distance));
+        std::vector<char> buffer(1024 * 1024);
+        for (size_t done = 0; done < size; done += buffer.size())
+        {
+            auto chunk = std::min(buffer.size(), size - done);
+            file.read(buffer.data(), std::streamsize(chunk));
+            if (size_t(file.gcount()) != chunk)
+            {
+                return false;
+            }
+            for (size_t i = 0; i < chunk; i++)
+            {
+                if (buffer[i] != pattern(done + i))
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+    void run(const char* name, const std::filesystem::path& path, size_t size, size_t distance, const std::function<void(std::fstream&)>& mover)
+    {
+        create(path, size);
+        std::fstream file(path, std::ios_base::binary | std::ios_base::in | std::ios_base::out);
+        auto started = std::chrono::steady_clock::now();
+        mover(file);
+        file.flush();
+        auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        file.close();
+        std::cout << name << ": " << seconds << " s, " << (shifted(path, size, distance) ? "data intact" : "DATA CORRUPTED") << std::endl;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    size_t size = (argc > 1 ? size_t(std::stoull(argv[1])) : 256) * 1024 * 1024;
+    size_t distance = argc > 2 ? size_t(std::stoull(argv[2])) : 1024;
+    auto directory = argc > 3 ? std::filesystem::path(argv[3]) : std::filesystem::temp_directory_path();
+    auto path = directory / "rvutil-copy-benchmark.bin";
+    std::cout << "Shifting " << size / (1024 * 1024) << " MiB up by " << distance << " bytes" << std::endl;
+
+    auto end = std::streampos(std::streamoff(size));
+    auto target = std::streampos(std::streamoff(distance));
+    run("copy<4096>", path, size, distance, [&](std::fstream& file) { legacy_copy<4096>(file, 0, end, target); });
+    run("copy<8192>", path, size, distance, [&](std::fstream& file) { legacy_copy<8192>(file, 0, end, target); });
+    run("move_range", path, size, distance, [&](std::fstream& file) { rv::util::move_range(path, file, 0, end, target); });
+
+    std::filesystem::remove(path);
+    return 0;
+}
@@ -0,0 +1,247 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define RVUTIL_HAS_IO_URING 1
+#include <cerrno>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace rv::util
+{
+    // Minimal io_uring submission/completion ring for positional reads.
+    //
+    // Remarks:
+    // - Talks to the kernel directly, liburing is not required.
+    // - Not available outside of Linux or if the kernel refuses io_uring, good() returns false then.
+    // - Not thread safe, a ring must only be used by one thread at a time.
+    class io_ring
+    {
+#if defined(RVUTIL_HAS_IO_URING)
+        int m_fd;
+        void* m_sq_ring;
+        size_t m_sq_ring_size;
+        void* m_cq_ring;
+        size_t m_cq_ring_size;
+        io_uring_sqe* m_sqes;
+        size_t m_sqes_size;
+        unsigned* m_sq_head;
+        unsigned* m_sq_tail;
+        unsigned* m_sq_array;
+        unsigned m_sq_mask;
+        unsigned m_sq_entries;
+        unsigned* m_cq_head;
+        unsigned* m_cq_tail;
+        io_uring_cqe* m_cqes;
+        unsigned m_cq_mask;
+        // Entries pushed but not yet handed to the kernel
+        unsigned m_unsubmitted;
+
+        static unsigned load_acquire(unsigned* value) { return std::atomic_ref<unsigned>(*value).load(std::memory_order_acquire); }
+        static void store_release(unsigned* value, unsigned v) { std::atomic_ref<unsigned>(*value).store(v, std::memory_order_release); }
+#endif
+
+        io_ring(const io_ring& copy) = delete;
+        io_ring& operator=(const io_ring& copy) = delete;
+    public:
+#if defined(RVUTIL_HAS_IO_URING)
+        io_ring() : m_fd(-1), m_sq_ring(nullptr), m_sq_ring_size(0), m_cq_ring(nullptr), m_cq_ring_size(0), m_sqes(nullptr), m_sqes_size(0),
+            m_sq_head(nullptr), m_sq_tail(nullptr), m_sq_array(nullptr), m_sq_mask(0), m_sq_entries(0),
+            m_cq_head(nullptr), m_cq_tail(nullptr), m_cqes(nullptr), m_cq_mask(0), m_unsubmitted(0) { }
+#else
+        io_ring() { }
+#endif
+        io_ring(unsigned entries) : io_ring() { open(entries); }
+        ~io_ring() { close(); }
+
+        // Sets up a ring with room for at least the provided amount of in-flight entries.
+        //
+        // Returns true on success.
+        bool open(unsigned entries)
+        {
+            close();
+#if defined(RVUTIL_HAS_IO_URING)
+            io_uring_params params;
+            std::memset(&params, 0, sizeof(params));
+            int fd = int(::syscall(__NR_io_uring_setup, entries, &params));
+            if (fd < 0)
+            {
+                return false;
+            }
+            m_fd = fd;
+            m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+            if (single_mmap)
+            {
+                m_sq_ring_size = m_cq_ring_size = m_sq_ring_size > m_cq_ring_size ? m_sq_ring_size : m_cq_ring_size;
+            }
+            auto sq = ::mmap(nullptr, m_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+            if (sq == MAP_FAILED)
+            {
+                close();
+                return false;
+            }
+            m_sq_ring = sq;
+            if (single_mmap)
+            {
+                m_cq_ring = m_sq_ring;
+            }
+            else
+            {
+                auto cq = ::mmap(nullptr, m_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+                if (cq == MAP_FAILED)
+                {
+                    close();
+                    return false;
+                }
+                m_cq_ring = cq;
+            }
+            m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+            auto sqes = ::mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+            if (sqes == MAP_FAILED)
+            {
+                close();
+                return false;
+            }
+            m_sqes = static_cast<io_uring_sqe*>(sqes);
+
+            auto sq_base = static_cast<char*>(m_sq_ring);
+            m_sq_head = reinterpret_cast<unsigned*>(sq_base + params.sq_off.head);
+            m_sq_tail = reinterpret_cast<unsigned*>(sq_base + params.sq_off.tail);
+            m_sq_array = reinterpret_cast<unsigned*>(sq_base + params.sq_off.array);
+            m_sq_mask = *reinterpret_cast<unsigned*>(sq_base + params.sq_off.ring_mask);
+            m_sq_entries = params.sq_entries;
+            auto cq_base = static_cast<char*>(m_cq_ring);
+            m_cq_head = reinterpret_cast<unsigned*>(cq_base + params.cq_off.head);
+            m_cq_tail = reinterpret_cast<unsigned*>(cq_base + params.cq_off.tail);
+            m_cqes = reinterpret_cast<io_uring_cqe*>(cq_base + params.cq_off.cqes);
+            m_cq_mask = *reinterpret_cast<unsigned*>(cq_base + params.cq_off.ring_mask);
+            return true;
+#else
+            (void)entries;
+            return false;
+#endif
+        }
+        void close()
+        {
+#if defined(RVUTIL_HAS_IO_URING)
+            if (m_sqes != nullptr) { ::munmap(m_sqes, m_sqes_size); }
+            if (m_cq_ring != nullptr && m_cq_ring != m_sq_ring) { ::munmap(m_cq_ring, m_cq_ring_size); }
+            if (m_sq_ring != nullptr) { ::munmap(m_sq_ring, m_sq_ring_size); }
+            if (m_fd >= 0) { ::close(m_fd); }
+            m_fd = -1;
+            m_sq_ring = m_cq_ring = nullptr;
+            m_sqes = nullptr;
+            m_sq_entries = 0;
+            m_unsubmitted = 0;
+#endif
+        }
+
+#if defined(RVUTIL_HAS_IO_URING)
+        bool good() const { return m_fd >= 0; }
+        // Amount of entries that may be in the submission queue at once.
+        unsigned capacity() const { return m_sq_entries; }
+#else
+        bool good() const { return false; }
+        unsigned capacity() const { return 0; }
+#endif
+
+        // Queues a read of bytes bytes at offset of fd into data.
+        // The result is reported by pop() along with user_data.
+        //
+        // Returns false if the submission queue is full.
+        bool push_read(int fd, void* data, unsigned bytes, uint64_t offset, uint64_t user_data)
+        {
+#if defined(RVUTIL_HAS_IO_URING)
+            if (!good())
+            {
+                return false;
+            }
+            auto tail = *m_sq_tail;
+            if (tail - load_acquire(m_sq_head) >= m_sq_entries)
+            {
+                return false;
+            }
+            auto index = tail & m_sq_mask;
+            auto& sqe = m_sqes[index];
+            std::memset(&sqe, 0, sizeof(sqe));
+            sqe.opcode = IORING_OP_READ;
+            sqe.fd = fd;
+            sqe.addr = uint64_t(reinterpret_cast<uintptr_t>(data));
+            sqe.len = bytes;
+            sqe.off = offset;
+            sqe.user_data = user_data;
+            m_sq_array[index] = index;
+            store_release(m_sq_tail, tail + 1);
+            m_unsubmitted++;
+            return true;
+#else
+            (void)fd; (void)data; (void)bytes; (void)offset; (void)user_data;
+            return false;
+#endif
+        }
+        // Hands all pushed entries to the kernel and waits until at least min_complete completions are available.
+        //
+        // Returns false if the kernel rejected the call.
+        bool submit(unsigned min_complete)
+        {
+#if defined(RVUTIL_HAS_IO_URING)
+            if (!good())
+            {
+                return false;
+            }
+            while (true)
+            {
+                auto res = ::syscall(__NR_io_uring_enter, m_fd, m_unsubmitted, min_complete, min_complete > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+                if (res < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (res < 0)
+                {
+                    return false;
+                }
+                m_unsubmitted -= unsigned(res) < m_unsubmitted ? unsigned(res) : m_unsubmitted;
+                return true;
+            }
+#else
+            (void)min_complete;
+            return false;
+#endif
+        }
+        // Takes the next completion, if any.
+        //
+        // Remarks:
+        // - result is the amount of bytes read or a negated errno value.
+        bool pop(uint64_t& out_user_data, int& out_result)
+        {
+#if defined(RVUTIL_HAS_IO_URING)
+            if (!good())
+            {
+                return false;
+            }
+            auto head = *m_cq_head;
+            if (head == load_acquire(m_cq_tail))
+            {
+                return false;
+            }
+            auto& cqe = m_cqes[head & m_cq_mask];
+            out_user_data = cqe.user_data;
+            out_result = cqe.res;
+            store_release(m_cq_head, head + 1);
+            return true;
+#else
+            (void)out_user_data; (void)out_result;
+            return false;
+#endif
+        }
+    };
+}
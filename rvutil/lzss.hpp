@@ -0,0 +1,422 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+namespace rv::util::lzss
+{
+    // Maximum distance a pointer may refer back
+    constexpr size_t window_size = 4096;
+    // Shortest sequence a pointer may represent
+    constexpr size_t min_match = 3;
+    // Longest sequence a pointer may represent
+    constexpr size_t max_match = 18;
+
+    // Streaming decompressor for the LZSS variant used by packed ("Cprs") PBO entries.
+    //
+    // Format:
+    // - A flag byte precedes up to 8 tokens, starting with the least significant bit.
+    // - Set bit: A single literal byte follows.
+    // - Cleared bit: A 2 byte pointer follows, holding a 12 bit distance
+    //   (low byte + high nibble of the second byte) and the length - 3 in the low nibble.
+    //   Positions before the start of the output read as spaces.
+    // - After the last token, a little-endian 32 bit sum of all decompressed bytes follows.
+    //
+    // Remarks:
+    // - Memory use is constant, independent of the decompressed size.
+    class decompressor
+    {
+    public:
+        // Reads up to `bytes` compressed bytes into `arr`, returning the amount of bytes read.
+        // Returning 0 signals the end of the input.
+        using source = std::function<size_t(char* arr, size_t bytes)>;
+    private:
+        static constexpr size_t input_capacity = 64 * 1024;
+        static constexpr size_t output_chunk = 64 * 1024;
+        // Largest input a single flag byte + 8 tokens may take
+        static constexpr size_t group_input = 1 + 8 * 2;
+        // Largest output a single flag byte + 8 tokens may produce
+        static constexpr size_t group_output = 8 * max_match;
+
+        source m_source;
+        std::vector<unsigned char> m_input;
+        size_t m_input_pos;
+        size_t m_input_end;
+        bool m_input_eof;
+
+        // Decoded data, preceded by window_size bytes of history.
+        // Initially, the history is filled with spaces.
+        std::vector<unsigned char> m_window;
+        // End of the decoded data in m_window
+        size_t m_window_end;
+        // Start of the decoded data not yet handed out in m_window
+        size_t m_pending;
+        // Output offset of m_window[window_size]
+        size_t m_window_base;
+
+        size_t m_size;
+        uint32_t m_checksum;
+        // Flag byte currently processed, shifted down per token.
+        // Holds a sentinel bit above the remaining flags, 1 means a new flag byte is required.
+        unsigned m_flags;
+        bool m_good;
+        bool m_done;
+
+        // Ensures at least `bytes` input bytes are available, unless the source ended.
+        size_t available(size_t bytes)
+        {
+            auto remaining = m_input_end - m_input_pos;
+            if (remaining >= bytes || m_input_eof)
+            {
+                return remaining;
+            }
+            std::memmove(m_input.data(), m_input.data() + m_input_pos, remaining);
+            m_input_pos = 0;
+            m_input_end = remaining;
+            while (m_input_end < m_input.size())
+            {
+                auto read = m_source(reinterpret_cast<char*>(m_input.data() + m_input_end), m_input.size() - m_input_end);
+                if (read == 0)
+                {
+                    m_input_eof = true;
+                    break;
+                }
+                m_input_end += read;
+            }
+            return m_input_end;
+        }
+        // Amount of bytes decoded so far
+        size_t produced() const { return m_window_base + m_window_end - window_size; }
+        // Decodes a whole flag group without any bounds checks.
+        //
+        // Remarks:
+        // - Caller has to ensure group_input bytes of input and group_output bytes of room.
+        // - Pointers may write up to max_match bytes, even if they are shorter.
+        static void decode_group(const unsigned char*& in, unsigned char*& out)
+        {
+            unsigned flags = *in++;
+            if (flags == 0xFF)
+            { // Only literals, the common case for poorly compressible data
+                std::memcpy(out, in, 8);
+                in += 8;
+                out += 8;
+                return;
+            }
+            for (int bit = 0; bit < 8; bit++, flags >>= 1)
+            {
+                if (flags & 1)
+                {
+                    *out++ = *in++;
+                    continue;
+                }
+                size_t distance = size_t(in[0]) | (size_t(in[1] & 0xF0) << 4);
+                size_t length = size_t(in[1] & 0x0F) + min_match;
+                in += 2;
+                // A distance of 0 refers to the oldest byte of the window
+                distance = ((distance - 1) & (window_size - 1)) + 1;
+                const unsigned char* from = out - distance;
+                if (distance >= max_match)
+                {
+                    std::memcpy(out, from, max_match);
+                }
+                else
+                { // Overlapping, repeats the last `distance` bytes
+                    for (size_t i = 0; i < length; i++)
+                    {
+                        out[i] = from[i];
+                    }
+                }
+                out += length;
+            }
+        }
+        // Decodes more data into m_window.
+        //
+        // Returns false if no further data could be decoded.
+        bool decode()
+        {
+            if (!m_good || m_done)
+            {
+                return false;
+            }
+
+            // Slide window, keeping the history required by pointers
+            if (m_window_end > window_size + output_chunk / 2)
+            {
+                auto drop = m_window_end - window_size;
+                std::memmove(m_window.data(), m_window.data() + drop, window_size);
+                m_window_base += drop;
+                m_window_end = window_size;
+                m_pending = window_size;
+            }
+
+            auto start = m_window_end;
+            auto limit = m_window.size() - max_match;
+            while (m_window_end < limit)
+            {
+                auto remaining = m_size - produced();
+                if (remaining == 0)
+                {
+                    break;
+                }
+
+                // Fast path, decoding whole groups
+                if (m_flags == 1
+                    && remaining >= group_output
+                    && m_window.size() - m_window_end >= group_output
+                    && available(group_input) >= group_input)
+                {
+                    const unsigned char* in = m_input.data() + m_input_pos;
+                    unsigned char* out = m_window.data() + m_window_end;
+                    decode_group(in, out);
+                    m_input_pos = size_t(in - m_input.data());
+                    m_window_end = size_t(out - m_window.data());
+                    continue;
+                }
+
+                // Slow path, decoding a single token with all checks
+                if (m_flags == 1)
+                {
+                    if (available(1) < 1)
+                    {
+                        m_good = false;
+                        break;
+                    }
+                    m_flags = 0x100u | m_input[m_input_pos++];
+                }
+                bool literal = (m_flags & 1) != 0;
+                m_flags >>= 1;
+                if (literal)
+                {
+                    if (available(1) < 1)
+                    {
+                        m_good = false;
+                        break;
+                    }
+                    m_window[m_window_end++] = m_input[m_input_pos++];
+                    continue;
+                }
+                if (available(2) < 2)
+                {
+                    m_good = false;
+                    break;
+                }
+                size_t distance = size_t(m_input[m_input_pos]) | (size_t(m_input[m_input_pos + 1] & 0xF0) << 4);
+                size_t length = size_t(m_input[m_input_pos + 1] & 0x0F) + min_match;
+                m_input_pos += 2;
+                distance = ((distance - 1) & (window_size - 1)) + 1;
+                length = length < remaining ? length : remaining;
+                for (size_t i = 0; i < length; i++, m_window_end++)
+                {
+                    m_window[m_window_end] = m_window[m_window_end - distance];
+                }
+            }
+
+            // Update checksum with everything decoded in this run
+            uint32_t checksum = 0;
+            for (auto i = start; i < m_window_end; i++)
+            {
+                checksum += m_window[i];
+            }
+            m_checksum += checksum;
+
+            // Validate checksum once the output is complete
+            if (m_good && produced() == m_size)
+            {
+                m_done = true;
+                if (available(4) < 4)
+                {
+                    m_good = false;
+                }
+                else
+                {
+                    auto in = m_input.data() + m_input_pos;
+                    uint32_t expected = uint32_t(in[0]) | (uint32_t(in[1]) << 8) | (uint32_t(in[2]) << 16) | (uint32_t(in[3]) << 24);
+                    m_input_pos += 4;
+                    m_good = expected == m_checksum;
+                }
+            }
+            return m_window_end != start;
+        }
+    public:
+        decompressor() : decompressor(0, {}) { }
+        // Creates a new decompressor, producing `size` bytes from the data provided by src.
+        decompressor(size_t size, source src) :
+            m_source(std::move(src)),
+            m_input(input_capacity),
+            m_input_pos(0),
+            m_input_end(0),
+            m_input_eof(false),
+            m_window(window_size + output_chunk, ' '),
+            m_window_end(window_size),
+            m_pending(window_size),
+            m_window_base(0),
+            m_size(size),
+            m_checksum(0),
+            m_flags(1),
+            m_good(bool(m_source)),
+            m_done(false)
+        {
+        }
+
+        // False if the input is corrupted, truncated or the checksum did not match.
+        bool good() const { return m_good; }
+        // True once all data was decoded and the checksum was validated.
+        bool done() const { return m_done && m_pending == m_window_end; }
+        // Amount of decompressed bytes handed out so far.
+        size_t tell() const { return m_window_base + m_pending - window_size; }
+        // Decompressed size
+        size_t size() const { return m_size; }
+
+        // Reads up to `bytes` decompressed bytes into `arr`.
+        //
+        // Returns the amount of bytes read, 0 at the end of the data or on error.
+        size_t read(char* arr, size_t bytes)
+        {
+            size_t total = 0;
+            while (total < bytes)
+            {
+                if (m_pending == m_window_end && !decode())
+                {
+                    break;
+                }
+                auto length = m_window_end - m_pending;
+                length = length < bytes - total ? length : bytes - total;
+                std::memcpy(arr + total, m_window.data() + m_pending, length);
+                m_pending += length;
+                total += length;
+            }
+            return total;
+        }
+    };
+
+    // Compressor producing the LZSS variant understood by decompressor.
+    //
+    // Remarks:
+    // - Matches are found using hash chains over the last window_size bytes.
+    // - Instances keep their tables between calls, but are not thread-safe.
+    //   Use one instance per thread.
+    class compressor
+    {
+        static constexpr size_t hash_bits = 15;
+        // Longest distance which can be encoded in 12 bits
+        static constexpr size_t max_distance = window_size - 1;
+
+        std::vector<int64_t> m_head;
+        std::vector<int64_t> m_prev;
+        size_t m_max_chain;
+
+        static size_t hash(const unsigned char* data)
+        {
+            uint32_t value = uint32_t(data[0]) << 16 | uint32_t(data[1]) << 8 | uint32_t(data[2]);
+            return size_t((value * 2654435761u) >> (32 - hash_bits));
+        }
+        void insert(const unsigned char* data, size_t pos)
+        {
+            auto h = hash(data + pos);
+            m_prev[pos & (window_size - 1)] = m_head[h];
+            m_head[h] = int64_t(pos);
+        }
+    public:
+        // Creates a new compressor, following at most max_chain candidates per position.
+        // Higher values compress better, but slower.
+        compressor(size_t max_chain = 32) : m_head(size_t(1) << hash_bits), m_prev(window_size), m_max_chain(max_chain == 0 ? 1 : max_chain) { }
+
+        // Compresses `size` bytes of `input`, appending the result, including the checksum, to output.
+        //
+        // Returns the amount of bytes appended.
+        size_t compress(const char* input, size_t size, std::vector<char>& output)
+        {
+            auto data = reinterpret_cast<const unsigned char*>(input);
+            auto begin = output.size();
+            output.reserve(begin + size + size / 8 + 1 + 4);
+            std::fill(m_head.begin(), m_head.end(), -1);
+
+            size_t pos = 0;
+            uint32_t checksum = 0;
+            while (pos < size)
+            {
+                auto flag_index = output.size();
+                output.push_back(0);
+                unsigned char flags = 0;
+                for (int bit = 0; bit < 8 && pos < size; bit++)
+                {
+                    size_t best_length = 0;
+                    size_t best_distance = 0;
+                    auto remaining = size - pos;
+                    if (remaining >= min_match)
+                    {
+                        auto limit = remaining < max_match ? remaining : max_match;
+                        auto candidate = m_head[hash(data + pos)];
+                        for (size_t chain = m_max_chain; candidate >= 0 && chain > 0; chain--)
+                        {
+                            auto distance = pos - size_t(candidate);
+                            if (distance > max_distance)
+                            {
+                                break;
+                            }
+                            auto match = data + candidate;
+                            // Cheap reject, candidate has to beat the best match at its last byte
+                            if (match[best_length] == data[pos + best_length])
+                            {
+                                size_t length = 0;
+                                while (length < limit && match[length] == data[pos + length])
+                                {
+                                    length++;
+                                }
+                                if (length > best_length)
+                                {
+                                    best_length = length;
+                                    best_distance = distance;
+                                    if (length == limit)
+                                    {
+                                        break;
+                                    }
+                                }
+                            }
+                            auto next = m_prev[size_t(candidate) & (window_size - 1)];
+                            if (next >= candidate)
+                            { // Slot got reused by a newer position
+                                break;
+                            }
+                            candidate = next;
+                        }
+                    }
+
+                    if (best_length >= min_match)
+                    {
+                        output.push_back(char(best_distance & 0xFF));
+                        output.push_back(char(((best_distance >> 4) & 0xF0) | (best_length - min_match)));
+                        for (size_t i = 0; i < best_length; i++, pos++)
+                        {
+                            checksum += data[pos];
+                            if (size - pos >= min_match)
+                            {
+                                insert(data, pos);
+                            }
+                        }
+                    }
+                    else
+                    {
+                        flags |= (unsigned char)(1 << bit);
+                        output.push_back(char(data[pos]));
+                        checksum += data[pos];
+                        if (remaining >= min_match)
+                        {
+                            insert(data, pos);
+                        }
+                        pos++;
+                    }
+                }
+                output[flag_index] = char(flags);
+            }
+
+            output.push_back(char(checksum & 0xFF));
+            output.push_back(char((checksum >> 8) & 0xFF));
+            output.push_back(char((checksum >> 16) & 0xFF));
+            output.push_back(char((checksum >> 24) & 0xFF));
+            return output.size() - begin;
+        }
+    };
+}
@@ -1,5 +1,6 @@
 ﻿#include "rvutil.hpp"
 
+#include <charconv>
 #include <iostream>
 #include <iomanip>
 
@@ -15,32 +16,35 @@ int list_pbo(filesystem::path file)
     }
 
     size_t max_meta_key_len = 0;
-    for (auto& [key, value] : pbo.attributes())
+    for (auto [key, value] : pbo.attribute_view())
     {
         max_meta_key_len = max_meta_key_len > key.length()
             ? max_meta_key_len
             : key.length();
     }
-    for (auto& [key, value] : pbo.attributes())
+    for (auto [key, value] : pbo.attribute_view())
     {
         cout << key << ": " << string(max_meta_key_len - key.length(), ' ') << value << '\n';
     }
     cout << endl;
     cout << "size actual" << " | " << "size original" << " | " << "file" << '\n';
-    for (auto& it : pbo.files())
+    // Reused for all files, only growing to the largest one
+    vector<char> data;
+    for (auto it : pbo.entries())
     {
-        cout << setw(11) << it.size << " | " << setw(13) << it.size << " | " << it.name << '\n';
-        rv::util::pbo::pbofile::reader reader;
-        if (pbo.read(it.name, reader))
+        cout << setw(11) << it.size << " | " << setw(13) << it.size_original << " | " << it.name << '\n';
+        auto size = max(it.size, it.size_original);
+        if (data.size() < size)
         {
-            vector<char> data;
-            data.resize(it.size);
-            reader.read(data.data(), data.size());
-            cout << "<CONTENTS>\n" << string_view(data.data(), data.size()) << endl;
+            data.resize(size);
+        }
+        if (pbo.read_into(it.name, data, size))
+        {
+            cout << "<CONTENTS>\n" << string_view(data.data(), size) << endl;
         }
         else
         {
-            cout << "Failed to open reader of '" << it.name << "'" << endl;
+            cout << "Failed to read '" << it.name << "'" << endl;
             return -1;
         }
     }
@@ -48,9 +52,234 @@ int list_pbo(filesystem::path file)
     return 0;
 }
 
+int extract_pbo(filesystem::path file, filesystem::path destination, size_t threads)
+{
+    rv::util::pbo::pbofile pbo;
+    pbo.open(file);
+    if (!pbo.good())
+    {
+        cout << "Reading in PBO '" << file << "' failed." << endl;
+        return -1;
+    }
+
+    rv::util::pbo::extract_options options;
+    options.threads = threads;
+    rv::util::pbo::extract_statistics statistics;
+    bool success = pbo.extract_all(destination, options, statistics);
+    auto megabytes = double(statistics.bytes) / (1024 * 1024);
+    cout << "Extracted " << statistics.files << " files (" << fixed << setprecision(2) << megabytes << " MB) in "
+        << statistics.seconds << " s, " << (statistics.seconds > 0 ? megabytes / statistics.seconds : 0) << " MB/s" << endl;
+    if (statistics.duplicates > 0)
+    {
+        cout << "Skipped " << statistics.duplicates << " files mapping to the path of an earlier file." << endl;
+    }
+    if (!success)
+    {
+        cout << "Extracting PBO '" << file << "' to " << destination << " failed." << endl;
+        return -1;
+    }
+    return 0;
+}
+
+int pack_pbo(filesystem::path directory, filesystem::path file, const vector<pair<string_view, string_view>>& attributes, const rv::util::pbo::compression_options& compression)
+{
+    rv::util::pbo::pbo_builder builder;
+    builder.compression(compression);
+    for (auto& [key, value] : attributes)
+    {
+        builder.attribute(key, value);
+    }
+    if (!builder.add_directory(directory))
+    {
+        cout << "Collecting files of " << directory << " failed." << endl;
+        return -1;
+    }
+    if (!builder.build(file))
+    {
+        cout << "Writing PBO " << file << " failed." << endl;
+        return -1;
+    }
+    return 0;
+}
+
+int verify_pbos(const vector<filesystem::path>& files, size_t threads)
+{
+    vector<bool> results;
+    bool success = rv::util::pbo::verify_all(files, threads, results);
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        cout << (results[i] ? "OK     " : "FAILED ") << files[i].string() << '\n';
+    }
+    cout << flush;
+    return success ? 0 : -1;
+}
+
+int defragment_pbo(filesystem::path file)
+{
+    rv::util::pbo::pbofile pbo;
+    pbo.open(file);
+    if (!pbo.good())
+    {
+        cout << "Reading in PBO '" << file << "' failed." << endl;
+        return -1;
+    }
+    auto before = filesystem::file_size(file);
+    if (!pbo.defragment())
+    {
+        cout << "Defragmenting PBO '" << file << "' failed." << endl;
+        return -1;
+    }
+    auto after = filesystem::file_size(file);
+    cout << "Defragmented " << file << ", " << before << " -> " << after << " bytes" << endl;
+    return 0;
+}
+
+int reclaim_pbo(filesystem::path file)
+{
+    rv::util::pbo::pbofile pbo;
+    pbo.open(file);
+    if (!pbo.good())
+    {
+        cout << "Reading in PBO '" << file << "' failed." << endl;
+        return -1;
+    }
+    size_t reclaimed = 0;
+    if (!pbo.reclaim(reclaimed))
+    {
+        cout << "Reclaiming space of PBO '" << file << "' failed." << endl;
+        return -1;
+    }
+    cout << "Reclaimed " << reclaimed << " bytes of " << file << endl;
+    return 0;
+}
+
+int usage()
+{
+    cout << "Usage:\n"
+        << "    rvutil list <pbo>\n"
+        << "    rvutil extract [-j <threads>] <pbo> [<destination>]\n"
+        << "    rvutil pack [-z] [-j <threads>] [-a <key>=<value>]... <directory> <pbo>\n"
+        << "    rvutil verify [-j <threads>] <pbo>...\n"
+        << "    rvutil defragment <pbo>\n"
+        << "    rvutil reclaim <pbo>" << endl;
+    return -1;
+}
+
+// Parses the value of a -j option, which must be a number of threads, 0 for one per hardware thread.
+bool parse_threads(string_view text, size_t& out_threads)
+{
+    auto res = from_chars(text.data(), text.data() + text.length(), out_threads);
+    return res.ec == errc() && res.ptr == text.data() + text.length();
+}
 
 int main(int argc, char **argv)
 {
+    if (argc > 1)
+    {
+        string_view command = argv[1];
+        if (command == "list"sv && argc == 3)
+        {
+            return list_pbo(argv[2]);
+        }
+        else if (command == "extract"sv)
+        {
+            size_t threads = 0;
+            vector<string_view> positional;
+            for (int i = 2; i < argc; i++)
+            {
+                if (argv[i] == "-j"sv && i + 1 < argc)
+                {
+                    if (!parse_threads(argv[++i], threads))
+                    {
+                        return usage();
+                    }
+                }
+                else
+                {
+                    positional.push_back(argv[i]);
+                }
+            }
+            if (positional.empty() || positional.size() > 2)
+            {
+                return usage();
+            }
+            filesystem::path file = positional[0];
+            filesystem::path destination = positional.size() == 2 ? filesystem::path(positional[1]) : file.parent_path() / file.stem();
+            return extract_pbo(file, destination, threads);
+        }
+        else if (command == "pack"sv)
+        {
+            vector<pair<string_view, string_view>> attributes;
+            rv::util::pbo::compression_options compression;
+            vector<string_view> positional;
+            for (int i = 2; i < argc; i++)
+            {
+                if (argv[i] == "-z"sv)
+                {
+                    compression.enabled = true;
+                }
+                else if (argv[i] == "-j"sv && i + 1 < argc)
+                {
+                    if (!parse_threads(argv[++i], compression.threads))
+                    {
+                        return usage();
+                    }
+                }
+                else if (argv[i] == "-a"sv && i + 1 < argc)
+                {
+                    string_view attribute = argv[++i];
+                    auto separator = attribute.find('=');
+                    if (separator == string_view::npos)
+                    {
+                        return usage();
+                    }
+                    attributes.emplace_back(attribute.substr(0, separator), attribute.substr(separator + 1));
+                }
+                else
+                {
+                    positional.push_back(argv[i]);
+                }
+            }
+            if (positional.size() != 2)
+            {
+                return usage();
+            }
+            return pack_pbo(positional[0], positional[1], attributes, compression);
+        }
+        else if (command == "verify"sv)
+        {
+            size_t threads = 0;
+            vector<filesystem::path> files;
+            for (int i = 2; i < argc; i++)
+            {
+                if (argv[i] == "-j"sv && i + 1 < argc)
+                {
+                    if (!parse_threads(argv[++i], threads))
+                    {
+                        return usage();
+                    }
+                }
+                else
+                {
+                    files.push_back(argv[i]);
+                }
+            }
+            if (files.empty())
+            {
+                return usage();
+            }
+            return verify_pbos(files, threads);
+        }
+        else if (command == "defragment"sv && argc == 3)
+        {
+            return defragment_pbo(argv[2]);
+        }
+        else if (command == "reclaim"sv && argc == 3)
+        {
+            return reclaim_pbo(argv[2]);
+        }
+        return usage();
+    }
     filesystem::path original = "R:\\my.pbo";
     filesystem::path copy = "R:\\my.trunc.pbo";
     if (filesystem::exists(original))
@@ -0,0 +1,180 @@
+#pragma once
+#include <cstddef>
+#include <filesystem>
+#include <span>
+#include <utility>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace rv::util
+{
+    // Read-only memory mapping of a whole file.
+    //
+    // Remarks:
+    // - Empty files are considered good, but have no data pointer.
+    // - The mapping stays valid until close() is called or the object is destroyed.
+    class mapped_file
+    {
+        const std::byte* m_data;
+        size_t m_size;
+        bool m_good;
+#if defined(_WIN32)
+        HANDLE m_file;
+        HANDLE m_mapping;
+#else
+        int m_fd;
+#endif
+
+        mapped_file(const mapped_file& copy) = delete;
+        mapped_file& operator=(const mapped_file& copy) = delete;
+    public:
+#if defined(_WIN32)
+        mapped_file() : m_data(nullptr), m_size(0), m_good(false), m_file(INVALID_HANDLE_VALUE), m_mapping(nullptr) { }
+#else
+        mapped_file() : m_data(nullptr), m_size(0), m_good(false), m_fd(-1) { }
+#endif
+        mapped_file(const std::filesystem::path& path) : mapped_file() { open(path); }
+        mapped_file(mapped_file&& other) noexcept : mapped_file() { swap(other); }
+        mapped_file& operator=(mapped_file&& other) noexcept
+        {
+            if (this != &other)
+            {
+                close();
+                swap(other);
+            }
+            return *this;
+        }
+        ~mapped_file() { close(); }
+
+        void swap(mapped_file& other) noexcept
+        {
+            std::swap(m_data, other.m_data);
+            std::swap(m_size, other.m_size);
+            std::swap(m_good, other.m_good);
+#if defined(_WIN32)
+            std::swap(m_file, other.m_file);
+            std::swap(m_mapping, other.m_mapping);
+#else
+            std::swap(m_fd, other.m_fd);
+#endif
+        }
+
+        // Maps the provided file into memory.
+        //
+        // Returns true on success.
+        bool open(const std::filesystem::path& path)
+        {
+            close();
+#if defined(_WIN32)
+            m_file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (m_file == INVALID_HANDLE_VALUE)
+            {
+                return false;
+            }
+            LARGE_INTEGER size;
+            if (!GetFileSizeEx(m_file, &size))
+            {
+                close();
+                return false;
+            }
+            m_size = size_t(size.QuadPart);
+            if (m_size == 0)
+            {
+                m_good = true;
+                return true;
+            }
+            m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (m_mapping == nullptr)
+            {
+                close();
+                return false;
+            }
+            m_data = static_cast<const std::byte*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+            if (m_data == nullptr)
+            {
+                close();
+                return false;
+            }
+#else
+            m_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (m_fd < 0)
+            {
+                return false;
+            }
+            struct stat st;
+            if (fstat(m_fd, &st) != 0)
+            {
+                close();
+                return false;
+            }
+            m_size = size_t(st.st_size);
+            if (m_size == 0)
+            {
+                m_good = true;
+                return true;
+            }
+            void* mapped = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+            if (mapped == MAP_FAILED)
+            {
+                close();
+                return false;
+            }
+            m_data = static_cast<const std::byte*>(mapped);
+#endif
+            m_good = true;
+            return true;
+        }
+        // Unmaps the file, invalidating all spans handed out.
+        void close()
+        {
+#if defined(_WIN32)
+            if (m_data != nullptr) { UnmapViewOfFile(m_data); }
+            if (m_mapping != nullptr) { CloseHandle(m_mapping); }
+            if (m_file != INVALID_HANDLE_VALUE) { CloseHandle(m_file); }
+            m_mapping = nullptr;
+            m_file = INVALID_HANDLE_VALUE;
+#else
+            if (m_data != nullptr) { munmap(const_cast<std::byte*>(m_data), m_size); }
+            if (m_fd >= 0) { ::close(m_fd); }
+            m_fd = -1;
+#endif
+            m_data = nullptr;
+            m_size = 0;
+            m_good = false;
+        }
+
+        bool good() const { return m_good; }
+        const std::byte* data() const { return m_data; }
+        size_t size() const { return m_size; }
+#if !defined(_WIN32)
+        // Descriptor of the mapped file, -1 if not open.
+        int descriptor() const { return m_fd; }
+#endif
+
+        // Returns the bytes in [offset, offset + length).
+        //
+        // Remarks:
+        // - If the range exceeds the mapping, an empty span is returned.
+        std::span<const std::byte> span(size_t offset, size_t length) const
+        {
+            if (offset > m_size || length > m_size - offset || m_data == nullptr)
+            {
+                return {};
+            }
+            return { m_data + offset, length };
+        }
+    };
+}
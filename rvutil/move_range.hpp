@@ -0,0 +1,121 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <new>
+
+#if !defined(_WIN32)
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace rv::util
+{
+    // Largest buffer move_range() moves data through.
+    inline constexpr size_t move_buffer_size = 1024 * 1024;
+    // Alignment of the buffer move_range() moves data through.
+    inline constexpr size_t move_buffer_alignment = 4096;
+
+    // Moves the data in [old_start, old_end) to new_start, where both ranges may overlap.
+    //
+    // Returns true on success.
+    //
+    // Remarks:
+    // - When moving up, chunks are copied back to front, front to back otherwise.
+    //   That way, no byte is overwritten before it was read.
+    // - Data is moved through a page aligned buffer of up to move_buffer_size bytes using positional reads and writes
+    //   (pread/pwrite) on a descriptor of path of its own. Windows falls back to seeking file.
+    // - file is flushed before and keeps its position, anything it buffered gets dropped.
+    inline bool move_range(const std::filesystem::path& path, std::fstream& file, std::streampos old_start, std::streampos old_end, std::streampos new_start)
+    {
+        std::streamoff length = old_end - old_start;
+        if (old_start == new_start || length <= 0)
+        {
+            return true;
+        }
+        // Get current position so we can seek back later
+        std::streampos cur = file.tellp();
+        file.flush();
+
+        auto buffer_size = std::min<std::streamoff>(length, move_buffer_size);
+        buffer_size = (buffer_size + move_buffer_alignment - 1) / move_buffer_alignment * move_buffer_alignment;
+        auto release = [](char* data) { ::operator delete(data, std::align_val_t(move_buffer_alignment)); };
+        std::unique_ptr<char, decltype(release)> buffer(static_cast<char*>(::operator new(size_t(buffer_size), std::align_val_t(move_buffer_alignment))), release);
+#if defined(_WIN32)
+        bool good = true;
+        auto read_at = [&file](char* data, std::streamoff offset, std::streamoff bytes) -> bool
+        {
+            file.seekg(offset);
+            file.read(data, bytes);
+            return file.gcount() == bytes;
+        };
+        auto write_at = [&file](const char* data, std::streamoff offset, std::streamoff bytes) -> bool
+        {
+            file.seekp(offset);
+            file.write(data, bytes);
+            return file.good();
+        };
+#else
+        int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+        bool good = fd >= 0;
+        auto read_at = [fd](char* data, std::streamoff offset, std::streamoff bytes) -> bool
+        {
+            while (bytes > 0)
+            {
+                auto done = ::pread(fd, data, size_t(bytes), off_t(offset));
+                if (done < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (done <= 0)
+                {
+                    return false;
+                }
+                data += done;
+                offset += done;
+                bytes -= done;
+            }
+            return true;
+        };
+        auto write_at = [fd](const char* data, std::streamoff offset, std::streamoff bytes) -> bool
+        {
+            while (bytes > 0)
+            {
+                auto done = ::pwrite(fd, data, size_t(bytes), off_t(offset));
+                if (done < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (done <= 0)
+                {
+                    return false;
+                }
+                data += done;
+                offset += done;
+                bytes -= done;
+            }
+            return true;
+        };
+#endif
+        bool backwards = new_start > old_start;
+        for (std::streamoff done = 0; good && done < length; done += buffer_size)
+        {
+            auto chunk = std::min<std::streamoff>(length - done, buffer_size);
+            auto offset = backwards ? length - done - chunk : done;
+            good = read_at(buffer.get(), old_start + offset, chunk) && write_at(buffer.get(), new_start + offset, chunk);
+        }
+#if !defined(_WIN32)
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+#endif
+        // Seek back to where we have been, which also drops what file buffered from before the move
+        file.clear();
+        file.seekp(cur);
+        return good;
+    }
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string_view>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RVUTIL_HAS_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace rv::util::path_key
+{
+    // Normalizes a single character: ASCII letters are lowercased, '/' becomes '\'.
+    constexpr char normalize(char c)
+    {
+        if (c >= 'A' && c <= 'Z')
+        {
+            return char(c + ('a' - 'A'));
+        }
+        return c == '/' ? '\\' : c;
+    }
+    // Writes the normalized form of in to out, which must hold at least in.length() characters.
+    //
+    // Remarks:
+    // - Non-ASCII characters are copied as they are.
+    // - in and out may be the same.
+    inline void normalize(std::string_view in, char* out)
+    {
+        size_t i = 0;
+#if defined(RVUTIL_HAS_SSE2)
+        // Characters are compared signed, so bytes above 0x7F never fall into 'A'..'Z'
+        const auto before_a = _mm_set1_epi8('A' - 1);
+        const auto after_z = _mm_set1_epi8('Z' + 1);
+        const auto case_bit = _mm_set1_epi8('a' - 'A');
+        const auto slash = _mm_set1_epi8('/');
+        const auto slash_flip = _mm_set1_epi8('/' ^ '\\');
+        for (; i + 16 <= in.length(); i += 16)
+        {
+            auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in.data() + i));
+            auto upper = _mm_and_si128(_mm_cmpgt_epi8(chunk, before_a), _mm_cmplt_epi8(chunk, after_z));
+            chunk = _mm_or_si128(chunk, _mm_and_si128(upper, case_bit));
+            chunk = _mm_xor_si128(chunk, _mm_and_si128(_mm_cmpeq_epi8(chunk, slash), slash_flip));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), chunk);
+        }
+#endif
+        for (; i < in.length(); i++)
+        {
+            out[i] = normalize(in[i]);
+        }
+    }
+    // Whether normalizing str would not change it.
+    inline bool is_normalized(std::string_view str)
+    {
+        for (auto c : str)
+        {
+            if (normalize(c) != c)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+    // Fast, non-cryptographic hash of a key, reading eight bytes per step.
+    inline size_t hash(std::string_view key)
+    {
+        constexpr uint64_t multiplier = 0x9E3779B97F4A7C15ull;
+        uint64_t h = uint64_t(key.length()) * multiplier;
+        size_t i = 0;
+        for (; i + 8 <= key.length(); i += 8)
+        {
+            uint64_t word;
+            std::memcpy(&word, key.data() + i, sizeof(word));
+            h = (h ^ word) * multiplier;
+            h ^= h >> 29;
+        }
+        uint64_t tail = 0;
+        if (i < key.length())
+        { // data() may be null for empty keys
+            std::memcpy(&tail, key.data() + i, key.length() - i);
+        }
+        h = (h ^ tail) * multiplier;
+        h ^= h >> 32;
+        return size_t(h);
+    }
+    // Normalized copy of a key, kept on the stack unless it is unusually long.
+    class buffer
+    {
+        static constexpr size_t inline_size = 256;
+        char m_inline[inline_size];
+        std::unique_ptr<char[]> m_heap;
+        std::string_view m_view;
+
+        buffer(const buffer& copy) = delete;
+        buffer& operator=(const buffer& copy) = delete;
+    public:
+        buffer(std::string_view key)
+        {
+            char* out = m_inline;
+            if (key.length() > inline_size)
+            {
+                m_heap = std::make_unique_for_overwrite<char[]>(key.length());
+                out = m_heap.get();
+            }
+            normalize(key, out);
+            m_view = std::string_view(out, key.length());
+        }
+        std::string_view view() const { return m_view; }
+    };
+}
@@ -1,10 +1,49 @@
 #pragma once
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
 #include <vector>
+#include <condition_variable>
+#include <deque>
 #include <filesystem>
 #include <fstream>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
 #include <optional>
+#include <set>
+#include <span>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
 #include <utility>
 
+#include "io_ring.hpp"
+#include "lzss.hpp"
+#include "mapped_file.hpp"
+#include "move_range.hpp"
+#include "path_key.hpp"
+#include "positional_file.hpp"
+#include "sha1.hpp"
+#include "string_arena.hpp"
+#include "thread_pool.hpp"
+
+#if !defined(_WIN32)
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <linux/falloc.h>
+#include <sys/sendfile.h>
+#endif
+
 namespace rv::util::pbo
 {
     enum class packing_method
@@ -26,34 +65,152 @@ namespace rv::util::pbo
         // The file name
         std::string name;
     };
+    // Describes a single file like file_descriptor, without copying its name.
+    struct entry_descriptor
+    {
+        // Size as in the PBO
+        size_t size;
+        // Size as the PBO header states this file actually is.
+        // May not be set for all packing methods
+        size_t size_original;
+        // The packing method used as stated in the header.
+        packing_method packing;
+        // The file name, pointing into the table of the pbofile
+        std::string_view name;
+    };
+    struct extract_options
+    {
+        // Number of worker threads to use.
+        // If 0, one thread per hardware thread is used.
+        size_t threads = 0;
+        // Whether existing files in the destination are replaced.
+        // If false, existing files are skipped.
+        bool overwrite = true;
+    };
+    struct batch_read_options
+    {
+        // Largest gap between the data of two files still read through, rather than starting a new read.
+        size_t max_gap = 64 * 1024;
+        // Bytes a single read may span before a new one is started.
+        // Files bigger than this are read on their own.
+        size_t max_read = 16 * 1024 * 1024;
+    };
+    struct extract_statistics
+    {
+        // Number of files written
+        size_t files;
+        // Number of bytes written
+        size_t bytes;
+        // Number of files skipped, as an earlier file maps to the same output path
+        size_t duplicates;
+        // Wall-clock time the extraction took
+        double seconds;
+    };
+    struct compression_options
+    {
+        // Whether files are LZSS compressed.
+        bool enabled = false;
+        // Number of worker threads to compress with.
+        // If 0, one thread per hardware thread is used.
+        size_t threads = 0;
+        // Whether files are stored uncompressed if compressing does not shrink them.
+        bool skip_incompressible = true;
+        // File extensions (lowercase, including the dot) which are never compressed,
+        // as their contents are compressed already.
+        std::vector<std::string> skip_extensions = { ".paa", ".pac", ".ogg", ".wss", ".jpg", ".png" };
+        // Hash chain candidates checked per position, see lzss::compressor
+        size_t max_chain = 32;
+    };
+    // Room to reserve in the table of new PBO files, see pbofile::create(path, options).
+    struct reserve_options
+    {
+        // Number of files expected to be added.
+        size_t expected_entries = 0;
+        // Bytes expected to be taken by attributes, counting keys and values plus one byte each.
+        size_t expected_attribute_bytes = 0;
+        // Average length of the file names expected, sizing the room for expected_entries.
+        size_t expected_name_length = 64;
+    };
+    // How data got moved to make room for a growing table, see pbofile::last_growth().
+    enum class growth_method
+    {
+        // The table did not need to push data back yet.
+        none,
+        // The file system inserted the room (FALLOC_FL_INSERT_RANGE), data was not touched.
+        insert_range,
+        // The data was copied further back.
+        copy
+    };
+    // How a writer treats the data of a file existing already.
+    enum class open_mode
+    {
+        // Copies the old data to the end of the PBO and writes there,
+        // leaving an empty section where the file was.
+        relocate,
+        // Writes straight into the old data. The file is only relocated once it outgrows it.
+        overwrite
+    };
+    // How file names are matched when looking up files, see pbofile::lookup().
+    enum class lookup_mode
+    {
+        // Names have to match byte by byte.
+        exact,
+        // Names match regardless of the case of ASCII letters and of '/' versus '\\'.
+        normalized
+    };
+    // How pbofile::open() treats the journal of an interrupted pbofile::defragment().
+    enum class journal_mode
+    {
+        // Completes the interrupted update, writing to the PBO, before reading it.
+        recover,
+        // Leaves journal and PBO untouched. Opening fails if the journal is still active.
+        fail
+    };
+    class pbo_view;
+    class pbo_builder;
+    class async_reader;
     class pbofile
     {
+        friend class pbo_view;
+        friend class pbo_builder;
+        friend class async_reader;
+        // Offsets of a range of bytes in the file.
         struct datablock
         {
-            std::streampos start;
-            std::streampos end;
+            std::streamoff start;
+            std::streamoff end;
 
-            size_t length() const { return end - start; }
+            size_t length() const { return size_t(end - start); }
         };
+        // Whether the provided name or key marks an empty section or invalidated attribute,
+        // consisting of nothing but '?'.
+        static bool is_invalid_name(std::string_view name)
+        {
+            for (auto c : name)
+            {
+                if (c != '?')
+                {
+                    return false;
+                }
+            }
+            return !name.empty();
+        }
+        // Whether name may be written as the name of a file.
+        // Empty names end the table, '\0' ends a name early and "?"-only names mark dead sections.
+        static bool is_valid_file_name(std::string_view name)
+        {
+            return !name.empty() && !is_invalid_name(name) && name.find('\0') == std::string_view::npos;
+        }
+        // Keys and values point into pbofile::m_names.
         struct attribute_
         {
-            std::string key;
-            std::string value;
+            std::string_view key;
+            std::string_view value;
 
             datablock block;
             bool operator<(const attribute_& other) const { return block.start < other.block.start; }
             bool operator>(const attribute_& other) const { return block.end < other.block.end; }
-            bool is_invalid() const
-            {
-                for (auto c : key)
-                {
-                    if (c != '?')
-                    {
-                        return false;
-                    }
-                }
-                return !key.empty();
-            }
+            bool is_invalid() const { return is_invalid_name(key); }
             size_t bytes() const
             {
                 return key.length() + 1 + value.length() + 1;
@@ -82,143 +239,291 @@ namespace rv::util::pbo
                 uint32_t size;
             } __attribute__((packed));
 #endif
-            std::string name;
+            // Fields needed for lookups and reading come first, which keeps a header in a single cache line.
+            // name points into pbofile::m_names.
+            std::string_view name;
+            datablock block_data;
+            uint32_t size;
             packing_method method;
 
             uint32_t size_original;
-            uint32_t size;
             uint32_t timestamp;
-
             datablock block_entry;
-            datablock block_data;
             bool operator<(const header& other) const { return block_data.start < other.block_data.start; }
             bool operator>(const header& other) const { return block_data.end < other.block_data.end; }
-            bool is_invalid() const
-            {
-                for (auto c : name)
-                {
-                    if (c != '?')
-                    {
-                        return false;
-                    }
-                }
-                return !name.empty();
-            }
+            bool is_invalid() const { return is_invalid_name(name); }
             size_t bytes() const
             {
                 return sizeof(bin) + name.length() + 1;
             }
+            // Whether the data is stored LZSS compressed.
+            //
+            // Remarks:
+            // - Packers store data uncompressed if it would not shrink,
+            //   which is signaled by the original size matching the stored size.
+            bool is_packed() const
+            {
+                return method == packing_method::compressed && size_original != 0 && size_original != size;
+            }
         };
     public:
+        // Reads the contents of a single file in the PBO.
+        //
+        // Remarks:
+        // - All readers of a pbofile share its file handle (see pbofile::m_data_file) and only keep their own offset.
+        //   Any number of readers may be used concurrently, a single reader must not.
+        // - Readers stay usable after the pbofile was closed or destroyed, but see data changed since.
+        // - Readers read the file directly, not through the stream of a writer. They do not see
+        //   data a writer has not flushed yet (see writer), and their size and data offsets are
+        //   taken from the header at the time of pbofile::read().
         class reader
         {
             friend class pbofile;
-            std::ifstream m_file;
+            std::shared_ptr<const positional_file> m_file;
             datablock m_block;
+            // Offset into the stored data of the next read
+            std::streamoff m_offset;
+            // Set for packed files, unpacking the stored data
+            std::unique_ptr<lzss::decompressor> m_decompressor;
+            // Size of the data handed out
+            size_t m_size;
             bool m_good;
 
             reader(const reader& copy) = delete;
             reader(const reader&& rcopy) = delete;
-            bool initialize(std::filesystem::path path, const header& h)
+            bool initialize(std::shared_ptr<const positional_file> file, const header& h)
             {
-                m_file.open(path, std::ios_base::binary | std::ios_base::in);
-                if (m_file.is_open() && m_file.good())
+                if (file == nullptr || !file->good())
                 {
-                    m_block = h.block_data;
-                    m_file.seekg(m_block.start);
-                    m_good = true;
-                    return true;
+                    return false;
                 }
-                else
+                m_file = std::move(file);
+                m_block = h.block_data;
+                m_offset = 0;
+                m_decompressor.reset();
+                m_size = m_block.length();
+                if (h.is_packed())
                 {
-                    return false;
+                    m_size = h.size_original;
+                    restart_unpacking();
+                }
+                m_good = true;
+                return true;
+            }
+            // Starts unpacking from the beginning of the stored data.
+            void restart_unpacking()
+            {
+                m_offset = 0;
+                m_decompressor = std::make_unique<lzss::decompressor>(m_size, [this](char* arr, size_t bytes) -> size_t {
+                    return read_stored(arr, std::streamsize(bytes));
+                });
+            }
+            // Reads the data as stored in the PBO.
+            size_t read_stored(char* arr, std::streamsize bytes)
+            {
+                auto remaining = std::streamoff(m_block.length()) - m_offset;
+                if (remaining <= 0 || bytes <= 0)
+                { // We already read everything readable
+                    return 0;
                 }
+                remaining = remaining < bytes ? remaining : bytes;
+                auto read = m_file->read_at(arr, size_t(remaining), uint64_t(m_block.start + m_offset));
+                m_offset += std::streamoff(read);
+                return read;
             }
         public:
-            reader() : m_good(false) { }
-            bool good() const { return m_good; }
+            reader() : m_offset(0), m_size(0), m_good(false) { }
+            // False if the reader was not initialized or packed data turned out to be corrupted.
+            bool good() const { return m_good && (!m_decompressor || m_decompressor->good()); }
+            // Size of the data, unpacked size for packed files.
+            size_t size() const { return m_size; }
+            // Reads up to `bytes` bytes into arr.
+            //
+            // Remarks:
+            // - Packed files are unpacked on the fly.
             size_t read(char* arr, std::streamsize bytes)
             {
                 if (!good())
                 { // Reader was not initialized proper
                     return 0;
                 }
-                auto pos = m_file.tellg();
-                auto remaining = m_block.end - pos;
-                if (remaining < 0)
-                { // We already read everything readable
-                    return 0;
+                if (m_decompressor)
+                {
+                    return m_decompressor->read(arr, size_t(bytes));
                 }
-                remaining = remaining < bytes ? remaining : bytes;
-                m_file.read(arr, remaining);
-                return (size_t)remaining;
+                return read_stored(arr, bytes);
             }
             std::streampos tell()
             {
-                auto pos = m_file.tellg();
-                return pos - m_block.start;
+                if (m_decompressor)
+                {
+                    return std::streamoff(m_decompressor->tell());
+                }
+                return m_offset;
             }
+            // Moves the read position, clamped to the data of this file.
+            //
+            // Remarks:
+            // - For packed files, seeking forward unpacks the data skipped
+            //   and seeking backward restarts unpacking from the beginning.
             void seek(std::streamoff offset, std::ios::seekdir dir)
             {
+                if (!good())
+                {
+                    return;
+                }
+                std::streamoff target = offset;
                 switch (dir)
                 {
-                    case std::ios::beg:
-                    {
-                        if (offset + m_block.start > m_block.end)
-                        {
-                            m_file.seekg(m_block.end, std::ios::beg);
-                        }
-                        else if (offset + m_block.start < m_block.start)
-                        {
-                            m_file.seekg(m_block.start, std::ios::beg);
-                        }
-                        else
-                        {
-                            m_file.seekg(offset, std::ios::beg);
-                        }
-                    } break;
-                    case std::ios::cur:
-                    {
-                        auto cur = m_file.tellg();
-                        if (cur + offset > m_block.end)
-                        {
-                            m_file.seekg(m_block.end, std::ios::beg);
-                        }
-                        else if (cur + offset < m_block.start)
-                        {
-                            m_file.seekg(m_block.start, std::ios::beg);
-                        }
-                        else
-                        {
-                            m_file.seekg(offset, std::ios::cur);
-                        }
-                    } break;
-                    case std::ios::end:
+                    case std::ios::beg: break;
+                    case std::ios::cur: target += std::streamoff(tell()); break;
+                    case std::ios::end: target += std::streamoff(m_size); break;
+                    default: return;
+                }
+                target = target < 0 ? 0 : target;
+                target = target > std::streamoff(m_size) ? std::streamoff(m_size) : target;
+                if (!m_decompressor)
+                {
+                    m_offset = target;
+                    return;
+                }
+                if (target < std::streamoff(tell()))
+                {
+                    restart_unpacking();
+                }
+                char buff[4096];
+                while (std::streamoff(tell()) < target)
+                {
+                    auto remaining = target - std::streamoff(tell());
+                    if (read(buff, remaining < std::streamoff(sizeof(buff)) ? remaining : std::streamoff(sizeof(buff))) == 0)
                     {
-                        if (offset + m_block.end > m_block.end)
-                        {
-                            m_file.seekg(m_block.end, std::ios::beg);
-                        }
-                        else if (offset + m_block.end < m_block.start)
-                        {
-                            m_file.seekg(m_block.start, std::ios::beg);
-                        }
-                        else
-                        {
-                            m_file.seekg(offset, std::ios::end);
-                        }
-                    } break;
+                        break;
+                    }
                 }
             }
         };
+        // Writes the contents of a single file in the PBO.
+        //
+        // Remarks:
+        // - Unbuffered writers persist the header with every write extending the file.
+        // - Buffered writers (see buffer_size) stage data in memory and only persist
+        //   the header on flush(), close() or destruction.
+        // - Writers for files of known size (see pbofile::write(name, writer, size)) may be placed
+        //   into empty sections, followed by an empty section taking over what they do not use.
+        // - Writers opened with open_mode::overwrite write into the old data of the file.
+        //   Regions not to be changed may be skipped using seek().
+        // - Writers write through their own stream, which buffers even if buffer_size is 0.
+        //   Readers (see reader, pbofile::read_many and async_reader) only see what was written
+        //   before the last flush(), close() or destruction of the writer.
         class writer
         {
             friend class pbofile;
             std::fstream m_file;
             bool m_good;
+            pbofile* m_pbo;
             header* m_header;
-            bool initialize(pbofile* pbo, std::string_view name)
+            // Whether m_header was placed into empty sections by pbofile::allocate.
+            // If so, the empty section covering the rest of them directly follows m_header.
+            bool m_placed;
+            // Whether data is written into the old data of an existing file (see open_mode::overwrite).
+            bool m_in_place;
+            // Staging buffer of buffered writers
+            std::vector<char> m_buffer;
+            size_t m_buffer_size;
+            // Bytes in m_buffer not yet written, belonging to the current file position
+            size_t m_pending;
+            // Whether m_header changed without being persisted
+            bool m_dirty;
+
+            writer(const writer& copy) = delete;
+            writer& operator=(const writer& copy) = delete;
+
+            // Writes out pending data.
+            void flush_pending()
+            {
+                if (m_pending == 0)
+                {
+                    return;
+                }
+                ensure_room(std::streamsize(m_pending));
+                m_file.write(m_buffer.data(), std::streamsize(m_pending));
+                m_pending = 0;
+                extend_to(m_file.tellp());
+            }
+            // Grows the data section of the header up to position, if it does not cover it already.
+            void extend_to(std::streampos position)
+            {
+                if (position > m_header->block_data.end)
+                {
+                    m_header->block_data.end = position;
+                    m_header->size = uint32_t(m_header->block_data.length());
+                    header_changed();
+                }
+            }
+            // Persists the header right away if unbuffered, otherwise on flush.
+            void header_changed()
+            {
+                if (m_placed)
+                { // The empty section behind takes whatever the header does not cover
+                    auto& section = *(m_header + 1);
+                    section.block_data.start = m_header->block_data.end;
+                    section.size = uint32_t(section.block_data.length());
+                }
+                m_dirty = true;
+                if (m_buffer_size == 0)
+                {
+                    write_headers();
+                }
+            }
+            // Writes out the header, plus the empty section following it if placed.
+            void write_headers()
+            {
+                write_header(m_file, *m_header);
+                if (m_placed)
+                {
+                    write_header(m_file, *(m_header + 1));
+                }
+                m_dirty = false;
+            }
+            // Makes sure bytes can be written at the current position.
+            // Placed files outgrowing their empty sections are moved to the end of the PBO.
+            void ensure_room(std::streamsize bytes)
+            {
+                if (!m_placed && !(m_in_place && !last()))
+                { // Free to grow
+                    return;
+                }
+                auto limit = m_placed ? (m_header + 1)->block_data.end : m_header->block_data.end;
+                if (std::streamoff(m_file.tellp()) + bytes <= std::streamoff(limit))
+                {
+                    return;
+                }
+                auto offset = m_file.tellp() - m_header->block_data.start;
+                if (m_dirty)
+                {
+                    write_headers();
+                }
+                // Copy the name, as moving may reallocate m_headers
+                auto name = m_header->name;
+                m_placed = false;
+                m_in_place = false;
+                m_header = &*m_pbo->move_to_end(m_file, name);
+                m_file.seekp(m_header->block_data.start + offset);
+            }
+            // Whether no data follows the data of m_header, allowing it to grow and shrink freely.
+            bool last() const
+            {
+                return m_header + 1 == &m_pbo->m_headers.back();
+            }
+            // Closes any previous file and opens the PBO for writing.
+            bool open(pbofile* pbo)
             {
+                close();
+                m_pending = 0;
+                m_dirty = false;
+                m_placed = false;
+                m_in_place = false;
+                m_pbo = pbo;
                 // Attempt to open the file
                 m_file.open(pbo->m_path, std::ios_base::binary | std::ios_base::out | std::ios::in);
 #if _DEBUG
@@ -229,258 +534,582 @@ namespace rv::util::pbo
                 auto DBG_BAD = m_file.bad();
                 auto DBG_RDSTATE = m_file.rdstate();
 #endif
-                if (!(m_file.is_open() && m_file.good()))
+                return m_file.is_open() && m_file.good();
+            }
+            // Creates a new, empty header at the very end.
+            bool append(pbofile* pbo, std::string_view name)
+            {
+                // Create new header
+                header created;
+                created.name = pbo->m_names.intern(name);
+                created.timestamp = (uint32_t)std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+                created.size = 0;
+                created.size_original = 0;
+                created.method = packing_method::none;
+                created.block_entry = { 0, 0 };
+                created.block_data = { 0, 0 };
+                m_header = &*pbo->push_back(m_file, created);
+
+
+                // Get EOF
+                m_file.seekg(0, std::ios::end);
+                auto eof = m_file.tellp();
+                m_header->block_data = { eof, eof };
+
+                // Set good to true and return true to indicate success.
+                m_good = true;
+                return true;
+            }
+            bool initialize(pbofile* pbo, std::string_view name)
+            {
+                if (!open(pbo))
                 {
                     return false;
                 }
-                auto oldcap = pbo->m_headers.capacity();
                 // Find existing header
-                auto iter = std::find_if(
-                    pbo->m_headers.begin(),
-                    pbo->m_headers.end(),
-                    [name](header h) -> bool {
-                    return h.name == name;
-                });
-                if (pbo->m_headers.end() != iter)
+                if (pbo->m_header_index.end() != pbo->find_index(name))
                 {
-                    // Create new header for copied data, rewrite data section to end
-                    auto block_data_length = iter->block_data.end - iter->block_data.start;
-                    std::vector<header>::iterator iter_created;
-                    {
-                        header created = *iter;
-                        created.name = name;
-                        created.timestamp = (uint32_t)std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
-                        created.block_entry = { 0, 0 };
-                        iter_created = pbo->push_back(m_file, created);
-                    }
-
-                    // Update possibly invalidated iterator
-                    if (pbo->m_headers.capacity() != oldcap)
-                    {
-                        iter = std::find_if(
-                            pbo->m_headers.begin(),
-                            pbo->m_headers.end(),
-                            [name](header& h) -> bool {
-                            return h.name == name;
-                        });
-                    }
-
-                    // Get EOF
-                    m_file.seekg(0, std::ios::end);
-                    auto eof = m_file.tellp();
-
-                    // Copy data to end
-                    copy<4096>(m_file, iter->block_data.start, iter->block_data.end, eof);
-
-                    // Update created data
-                    iter_created->block_data.start = eof;
-                    iter_created->block_data.end = eof + (iter->block_data.end - iter->block_data.start);
-                    pbo->write_header(m_file, *iter_created);
-
-                    // Rename old header to represent empty section
-                    std::transform(iter->name.begin(), iter->name.end(), iter->name.begin(), [](char c) -> char { return '?'; });
-                    pbo->write_header(m_file, *iter);
-
-                    m_header = &*iter_created;
+                    // Rewrite data section to end, keeping the old contents
+                    m_header = &*pbo->move_to_end(m_file, name);
                     // Set good to true and return true to indicate success.
                     m_good = true;
                     return true;
                 }
                 else
                 {
-                    // Create new header
-                    header created;
-                    created.name = name;
-                    created.timestamp = (uint32_t)std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
-                    created.size = 0;
-                    created.size_original = 0;
-                    created.method = packing_method::none;
-                    created.block_entry = { 0, 0 };
-                    created.block_data = { 0, 0 };
-                    m_header = &*pbo->push_back(m_file, created);
-
-
-                    // Get EOF
-                    m_file.seekg(0, std::ios::end);
-                    auto eof = m_file.tellp();
-                    m_header->block_data = { eof, eof };
-
-                    // Set good to true and return true to indicate success.
-                    m_good = true;
-                    return true;
+                    return append(pbo, name);
+                }
+            }
+            // Initializes the writer to write into the old data of an existing file.
+            // New files are appended like initialize(pbo, name) does.
+            bool initialize(pbofile* pbo, std::string_view name, open_mode mode)
+            {
+                auto existing = pbo->find_index(name);
+                if (mode == open_mode::relocate || pbo->m_header_index.end() == existing)
+                {
+                    return initialize(pbo, name);
+                }
+                if (!open(pbo))
+                {
+                    return false;
+                }
+                m_header = &pbo->m_headers[existing->second];
+                m_in_place = true;
+                // An empty section behind may be grown into
+                m_placed = !last() && (m_header + 1)->is_invalid();
+                m_header->timestamp = (uint32_t)std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+                m_good = true;
+                header_changed();
+                m_file.seekp(m_header->block_data.start);
+                return true;
+            }
+            // Initializes the writer for a file of at most capacity bytes, placing it into
+            // the best fitting empty section if there is one, at the end otherwise.
+            // Previous contents of the file are discarded.
+            bool initialize(pbofile* pbo, std::string_view name, size_t capacity)
+            {
+                if (!open(pbo))
+                {
+                    return false;
                 }
+                auto existing = pbo->find_index(name);
+                if (pbo->m_header_index.end() != existing)
+                { // Turn the old data into an empty section, so it may be reused right away
+                    auto& old = pbo->m_headers[existing->second];
+                    pbo->make_empty_name(old, m_file);
+                    old.name = pbo->m_names.intern(old.name.length(), '?');
+                    pbo->m_header_index.erase(existing);
+                }
+                auto placed = pbo->allocate(m_file, name, capacity);
+                if (placed == pbo->m_headers.end())
+                {
+                    return append(pbo, name);
+                }
+                m_header = &*placed;
+                m_placed = true;
+                m_file.seekp(m_header->block_data.start);
+                m_good = true;
+                return true;
             }
         public:
+            writer() : m_good(false), m_pbo(nullptr), m_header(nullptr), m_placed(false), m_in_place(false), m_buffer_size(0), m_pending(0), m_dirty(false) { }
+            // Creates a buffered writer, staging up to buffer_size bytes before writing them out.
+            explicit writer(size_t buffer_size) : writer() { m_buffer_size = buffer_size; }
+            ~writer() { close(); }
+
             std::streampos tell()
             {
-                auto pos = m_file.tellg();
+                auto pos = m_file.tellp() + std::streamoff(m_pending);
                 return pos - m_header->block_data.start;
             }
             bool good() const { return m_good; }
+
+            // Size of the staging buffer, 0 for unbuffered writers.
+            size_t buffer_size() const { return m_buffer_size; }
+            void buffer_size(size_t bytes)
+            {
+                if (good())
+                {
+                    flush_pending();
+                }
+                m_buffer_size = bytes;
+            }
+
+            // Moves the write position inside of the data written so far.
+            // The position is clamped to the data section.
             void seek(std::streamoff offset, std::ios::seekdir dir)
             {
+                if (!good())
+                {
+                    return;
+                }
+                flush_pending();
+                std::streamoff start = m_header->block_data.start;
+                std::streamoff end = m_header->block_data.end;
+                std::streamoff target;
                 switch (dir)
                 {
-                    case std::ios::beg:
-                    {
-                        if (offset + m_header->block_data.start > m_header->block_data.end)
-                        {
-                            m_file.seekg(m_header->block_data.end, std::ios::beg);
-                        }
-                        else if (offset + m_header->block_data.start < m_header->block_data.start)
-                        {
-                            m_file.seekg(m_header->block_data.start, std::ios::beg);
-                        }
-                        else
-                        {
-                            m_file.seekg(offset, std::ios::beg);
-                        }
-                    } break;
-                    case std::ios::cur:
-                    {
-                        auto cur = m_file.tellg();
-                        if (cur + offset > m_header->block_data.end)
-                        {
-                            m_file.seekg(m_header->block_data.end, std::ios::beg);
-                        }
-                        else if (cur + offset < m_header->block_data.start)
-                        {
-                            m_file.seekg(m_header->block_data.start, std::ios::beg);
-                        }
-                        else
-                        {
-                            m_file.seekg(offset, std::ios::cur);
-                        }
-                    } break;
-                    case std::ios::end:
-                    {
-                        if (offset + m_header->block_data.end > m_header->block_data.end)
-                        {
-                            m_file.seekg(m_header->block_data.end, std::ios::beg);
-                        }
-                        else if (offset + m_header->block_data.end < m_header->block_data.start)
-                        {
-                            m_file.seekg(m_header->block_data.start, std::ios::beg);
-                        }
-                        else
-                        {
-                            m_file.seekg(offset, std::ios::end);
-                        }
-                    } break;
+                    case std::ios::beg: target = start + offset; break;
+                    case std::ios::cur: target = std::streamoff(m_file.tellp()) + offset; break;
+                    case std::ios::end: default: target = end + offset; break;
                 }
+                target = target < start ? start : target > end ? end : target;
+                m_file.seekp(target);
             }
+            // Writes data at the current position, growing the file if writing past its end.
             void write(const char* arr, std::streamsize bytes)
             {
                 if (!good())
-                { // Reader was not initialized proper
+                { // Writer was not initialized proper
                     return;
                 }
-                m_file.write(arr, bytes);
-                m_header->block_data.end += bytes;
-                m_header->size += bytes;
-                write_header(m_file, *m_header);
+                if (m_buffer_size == 0)
+                {
+                    ensure_room(bytes);
+                    m_file.write(arr, bytes);
+                    extend_to(m_file.tellp());
+                    return;
+                }
+                if (m_pending + size_t(bytes) > m_buffer_size)
+                {
+                    flush_pending();
+                }
+                if (size_t(bytes) >= m_buffer_size)
+                { // Too large for staging, write straight through
+                    ensure_room(bytes);
+                    m_file.write(arr, bytes);
+                    extend_to(m_file.tellp());
+                    return;
+                }
+                if (m_buffer.size() < m_buffer_size)
+                {
+                    m_buffer.resize(m_buffer_size);
+                }
+                std::memcpy(m_buffer.data() + m_pending, arr, size_t(bytes));
+                m_pending += size_t(bytes);
             }
-
-            // Removes any data remaining for the current header.
+            // Writes out pending data and persists the header.
+            void flush()
+            {
+                if (!good())
+                {
+                    return;
+                }
+                flush_pending();
+                if (m_dirty)
+                {
+                    write_headers();
+                }
+                m_file.flush();
+            }
+            // Flushes and closes the writer.
+            void close()
+            {
+                flush();
+                m_file.close();
+                m_good = false;
+            }
+
+            // Removes any data remaining for the current header.
             //
             // Remarks:
             // - Due to STL limitations, this cannot erase physical data
             //   The remaining data in this file thus remains unchanged
             //   and only `size_actual` is updated.
+            // - Files overwritten in place (see open_mode::overwrite) hand the bytes
+            //   cut off to an empty section behind them.
             void truncate()
             {
+                if (!good())
+                {
+                    return;
+                }
+                flush_pending();
+                if (m_in_place && !m_placed && !last() && m_file.tellp() < m_header->block_data.end)
+                { // Data behind stays where it is, the bytes cut off need an empty section
+                    auto offset = m_file.tellp() - m_header->block_data.start;
+                    if (m_dirty)
+                    {
+                        write_headers();
+                    }
+                    auto name = m_header->name;
+                    m_header = &*m_pbo->insert_empty_section(m_file, name);
+                    m_placed = !last();
+                    m_file.seekp(m_header->block_data.start + offset);
+                }
                 m_header->block_data.end = m_file.tellp();
-                m_header->size = m_header->block_data.length();
+                m_header->size = uint32_t(m_header->block_data.length());
+                header_changed();
+            }
+            // Compresses the provided data and writes it, marking this file as packed.
+            //
+            // Remarks:
+            // - Intended to write the complete contents of a file in one call.
+            // - If compressing does not shrink the data, it is written uncompressed.
+            void write_packed(const char* arr, std::streamsize bytes)
+            {
+                if (!good())
+                { // Writer was not initialized proper
+                    return;
+                }
+                std::vector<char> packed;
+                lzss::compressor().compress(arr, size_t(bytes), packed);
+                if (bytes == 0 || packed.size() >= size_t(bytes))
+                {
+                    write(arr, bytes);
+                    return;
+                }
+                m_header->method = packing_method::compressed;
+                m_header->size_original = uint32_t(bytes);
+                header_changed();
+                write(packed.data(), std::streamsize(packed.size()));
             }
             size_t original_size() const { return m_header->size_original; }
-            void original_size(uint32_t bytes) { m_header->size_original = bytes; write_header(m_file, *m_header); }
+            void original_size(uint32_t bytes) { m_header->size_original = bytes; header_changed(); }
 
             packing_method method() const { return m_header->method; }
-            void method(packing_method m) { m_header->method = m; write_header(m_file, *m_header); }
+            void method(packing_method m) { m_header->method = m; header_changed(); }
+        };
+    private:
+        // Hash for name indices, allowing lookups of std::string keys using std::string_view
+        //
+        // Remarks:
+        // - Hashes are computed once on insertion and kept in the index nodes.
+        struct name_hash
+        {
+            using is_transparent = void;
+            size_t operator()(std::string_view view) const { return path_key::hash(view); }
+        };
+        // Maps names to their slot in m_headers or m_attributes.
+        // Only valid (non-empty-section) entries are contained, keys point into m_names.
+        using name_index = std::unordered_map<std::string_view, size_t, name_hash>;
+
+        // Describes the items yielded by table_range.
+        static entry_descriptor describe(const header& h)
+        {
+            return { h.size, h.size_original, h.method, h.name };
+        }
+        static std::pair<std::string_view, std::string_view> describe(const attribute_& att)
+        {
+            return { att.key, att.value };
+        }
+    public:
+        // Forward range over the headers or attributes of a pbofile,
+        // skipping empty sections while iterating.
+        //
+        // Remarks:
+        // - Items are described by value (see describe), views handed out point into the table.
+        // - Ranges and everything they handed out are invalidated by modifying or reopening the pbofile.
+        template<typename item, typename descriptor>
+        class table_range
+        {
+            const item* m_begin;
+            const item* m_end;
+        public:
+            class iterator
+            {
+                const item* m_current;
+                const item* m_end;
+
+                void skip_invalid()
+                {
+                    while (m_current != m_end && m_current->is_invalid())
+                    {
+                        ++m_current;
+                    }
+                }
+            public:
+                using iterator_concept = std::forward_iterator_tag;
+                using iterator_category = std::input_iterator_tag;
+                using value_type = descriptor;
+                using difference_type = std::ptrdiff_t;
+                using reference = descriptor;
+
+                iterator() : m_current(nullptr), m_end(nullptr) { }
+                iterator(const item* current, const item* end) : m_current(current), m_end(end) { skip_invalid(); }
+
+                descriptor operator*() const { return describe(*m_current); }
+                iterator& operator++()
+                {
+                    ++m_current;
+                    skip_invalid();
+                    return *this;
+                }
+                iterator operator++(int)
+                {
+                    auto copy = *this;
+                    ++*this;
+                    return copy;
+                }
+                bool operator==(const iterator& other) const { return m_current == other.m_current; }
+            };
+
+            table_range() : m_begin(nullptr), m_end(nullptr) { }
+            // Covers all items in front of the terminator of the provided table.
+            table_range(const std::vector<item>& table)
+                : m_begin(table.empty() ? nullptr : table.data()),
+                  m_end(table.empty() ? nullptr : table.data() + table.size() - /* terminator */ 1) { }
+
+            iterator begin() const { return iterator(m_begin, m_end); }
+            iterator end() const { return iterator(m_end, m_end); }
+            bool empty() const { return begin() == end(); }
         };
+        using entry_range = table_range<header, entry_descriptor>;
+        using attribute_range = table_range<attribute_, std::pair<std::string_view, std::string_view>>;
     private:
         std::filesystem::path m_path;
+        // Handle of m_path shared by all readers, opened along with the table.
+        std::shared_ptr<const positional_file> m_data_file;
         std::vector<datablock> m_free_blocks;
+        // Storage of all names, keys and values referenced by m_headers and m_attributes.
+        //
+        // Remarks:
+        // - Renamed, removed and replaced entries leave their old name behind. Those are released when the
+        //   table is read in again or compacted (see compact_names) by defragment(), reclaim() and transactions.
+        string_arena m_names;
         std::vector<header> m_headers;
         std::vector<attribute_> m_attributes;
+        name_index m_header_index;
+        name_index m_attribute_index;
+        lookup_mode m_lookup;
+        // Storage of normalized names used as keys of m_header_index in lookup_mode::normalized,
+        // for names which are not normalized already. Cleared whenever m_header_index is rebuilt.
+        string_arena m_keys;
         bool m_good;
+        growth_method m_growth;
 
-        // Finds the '\0' character in a filestream and returns the characters required to reach it.
-        // Always returns not null on success
-        // Stream position will be reset on method exit.
-        static size_t strlen(std::fstream& file)
+        // Looks up the valid header with the provided name.
+        //
+        // Remarks:
+        // - Returns nullptr if no such header exists.
+        const header* find_header(std::string_view filename) const
+        {
+            auto res = find_index(filename);
+            return res == m_header_index.end() ? nullptr : &m_headers[res->second];
+        }
+        // Looks up the provided name in m_header_index, normalizing it first in lookup_mode::normalized.
+        name_index::const_iterator find_index(std::string_view name) const
+        {
+            if (m_lookup == lookup_mode::exact)
+            {
+                return m_header_index.find(name);
+            }
+            path_key::buffer key(name);
+            return m_header_index.find(key.view());
+        }
+        name_index::iterator find_index(std::string_view name)
+        {
+            if (m_lookup == lookup_mode::exact)
+            {
+                return m_header_index.find(name);
+            }
+            path_key::buffer key(name);
+            return m_header_index.find(key.view());
+        }
+        // Returns the key of the provided name in m_header_index.
+        std::string_view index_key(std::string_view name)
+        {
+            if (m_lookup == lookup_mode::exact || path_key::is_normalized(name))
+            {
+                return name;
+            }
+            auto key = m_keys.intern(name);
+            path_key::normalize(key, const_cast<char*>(key.data()));
+            return key;
+        }
+        // Rebuilds m_header_index from m_headers.
+        // Needs to be called whenever headers got reordered.
+        //
+        // Remarks:
+        // - For duplicate names, the first header wins.
+        void index_headers()
         {
-            const size_t buff_size = 256;
-            char buff[buff_size];
-            auto start_pos = file.tellg();
-            file.seekg(0, std::ios::end);;
-            auto eof = file.tellg();
-            file.seekg(start_pos);
-            int runs = 0;
-            do
+            m_header_index.clear();
+            m_keys.clear();
+            m_header_index.reserve(m_headers.size());
+            for (size_t i = 0; i < m_headers.size(); i++)
             {
-                file.read(buff, buff_size);
-                for (size_t i = 0; i < buff_size; i++)
+                if (m_headers[i].name.empty() || m_headers[i].is_invalid())
                 {
-                    if (buff[i] == '\0')
-                    {
-                        file.clear();
-                        file.seekg(start_pos);
-                        return i + (runs * buff_size) + 1;
-                    }
+                    continue;
+                }
+                m_header_index.emplace(index_key(m_headers[i].name), i);
+            }
+        }
+        // Rebuilds m_attribute_index from m_attributes.
+        // Needs to be called whenever attributes got reordered.
+        //
+        // Remarks:
+        // - For duplicate keys, the first attribute wins.
+        void index_attributes()
+        {
+            m_attribute_index.clear();
+            m_attribute_index.reserve(m_attributes.size());
+            for (size_t i = 0; i < m_attributes.size(); i++)
+            {
+                if (m_attributes[i].key.empty() || m_attributes[i].is_invalid())
+                {
+                    continue;
                 }
-                runs++;
-            } while (file.tellg() < eof && !file.eof());
-            file.seekg(start_pos);
-            return -1;
+                m_attribute_index.emplace(m_attributes[i].key, i);
+            }
         }
 
-        // Reads a single c-styled string from the file stream.
-        // Stream position will reset stream on error.
-        static std::optional<std::string> read_string(std::fstream& file)
+        // Moves all names, keys and values of the table into a fresh m_names, releasing everything
+        // left behind by earlier changes. Rebuilds both indices, as their keys point into m_names.
+        void compact_names()
         {
-            auto zero = strlen(file);
+            string_arena names;
+            for (auto& it : m_headers)
+            {
+                it.name = names.intern(it.name);
+            }
+            for (auto& it : m_attributes)
+            {
+                it.key = names.intern(it.key);
+                it.value = names.intern(it.value);
+            }
+            m_names = std::move(names);
+            index_headers();
+            index_attributes();
+        }
 
-            if (zero == 0) { return {}; }
-            if (zero == -1) { return {}; }
-            std::vector<char> buff;
-            buff.resize(zero);
-            file.read(buff.data(), zero);
-            buff.resize(zero - 1);
-            return std::string{ buff.begin(), buff.end() };
+        // Size of the trailer of sealed PBO files:
+        // A single '\0' followed by the SHA-1 hash of all bytes before it.
+        static constexpr size_t trailer_size = 1 + std::tuple_size_v<sha1::digest_type>;
+
+        // Returns the offset right after the last data block, which is where the trailer starts.
+        std::streamoff data_end() const
+        {
+            if (m_headers.empty())
+            {
+                return 0;
+            }
+            std::streamoff end = m_headers.back().block_entry.end;
+            // The terminator is skipped, as it is not updated when the last file gets truncated
+            for (auto it = m_headers.begin(); it != m_headers.end() - /* empty header */ 1; ++it)
+            {
+                end = std::max(end, std::streamoff(it->block_data.end));
+            }
+            return end;
+        }
+        // Removes everything behind the last data block, including the trailer.
+        // Needs to be called before modifying the file, as new data gets appended at its end.
+        //
+        // Returns true on success.
+        bool strip_trailer()
+        {
+            if (!good())
+            {
+                return false;
+            }
+            std::error_code ec;
+            auto size = std::filesystem::file_size(m_path, ec);
+            auto end = uintmax_t(data_end());
+            if (!ec && size > end)
+            {
+                std::filesystem::resize_file(m_path, end, ec);
+            }
+            return !ec;
         }
-        // Writes a single c-styled string to the file stream.
-        static void write_string(std::fstream& file, std::string_view view)
+        // Writes the trailer for the provided hash.
+        static void write_trailer(std::ostream& file, const sha1::digest_type& digest)
         {
-            file.write(view.data(), view.length());
             file.write("\0", 1);
+            file.write(reinterpret_cast<const char*>(digest.data()), std::streamsize(digest.size()));
         }
 
-        // Reads a single pbo attribute_ from the file.
-        // Stream position will reset stream on error.
-        static std::optional<attribute_> read_attribute(std::fstream& file)
+        // Converts a file name, as stored in the PBO, into a relative path.
+        //
+        // Remarks:
+        // - Both '\' and '/' are treated as separators.
+        // - Returns empty optional if the name is empty, absolute or contains '..' segments.
+        static std::optional<std::filesystem::path> to_relative_path(std::string_view name)
         {
-            auto start_pos = file.tellg();
-            auto key = read_string(file);
-            if (key.has_value() && !key->empty())
+            std::filesystem::path path;
+            size_t start = 0;
+            while (start <= name.length())
             {
-                auto value = read_string(file);
-                if (value.has_value())
+                auto end = name.find_first_of("\\/", start);
+                end = end == std::string_view::npos ? name.length() : end;
+                auto segment = name.substr(start, end - start);
+                start = end + 1;
+                if (segment.empty() || segment == ".")
                 {
-                    auto end_pos = file.tellg();
-                    return attribute_{ *key, *value, { start_pos, end_pos } };
+                    continue;
                 }
-                else
+                if (segment == ".." || segment.find(':') != std::string_view::npos)
                 {
-                    file.seekg(start_pos);
                     return {};
                 }
+                path /= segment;
             }
-            else
+            if (path.empty())
             {
-                file.seekg(start_pos);
                 return {};
             }
+            return path;
+        }
+
+        // Reads a single c-styled string from the in-memory buffer, starting at pos.
+        // On success, pos is moved past the terminating '\0'.
+        //
+        // Remarks:
+        // - Returns empty optional if no '\0' is contained in the remaining buffer.
+        // - The returned view points into buffer.
+        static std::optional<std::string_view> read_string(std::string_view buffer, size_t& pos)
+        {
+            if (pos >= buffer.size()) { return {}; }
+            auto zero = static_cast<const char*>(std::memchr(buffer.data() + pos, '\0', buffer.size() - pos));
+            if (zero == nullptr) { return {}; }
+            auto length = size_t(zero - (buffer.data() + pos));
+            auto view = buffer.substr(pos, length);
+            pos += length + 1;
+            return view;
+        }
+        // Writes a single c-styled string to the output stream.
+        static void write_string(std::ostream& file, std::string_view view)
+        {
+            if (!view.empty())
+            { // Empty views may not point anywhere
+                file.write(view.data(), std::streamsize(view.length()));
+            }
+            file.write("\0", 1);
+        }
+
+        // Reads a single pbo attribute_ from the in-memory buffer, starting at pos.
+        // buffer is expected to start at file offset 0, key and value point into it.
+        // pos is left untouched on error.
+        static std::optional<attribute_> read_attribute(std::string_view buffer, size_t& pos)
+        {
+            auto cur = pos;
+            auto key = read_string(buffer, cur);
+            if (!key.has_value() || key->empty()) { return {}; }
+            auto value = read_string(buffer, cur);
+            if (!value.has_value()) { return {}; }
+            attribute_ actual{ *key, *value, { std::streamoff(pos), std::streamoff(cur) } };
+            pos = cur;
+            return actual;
         }
         // Writes a single pbo attribute_ to the file stream where attribute_::data.start refers to
         // 
@@ -488,7 +1117,7 @@ namespace rv::util::pbo
         // - is_update: true
         //   - Auto-Reset on end
         //   - Auto-Seek to attribute_ on start
-        static void write_attribute(std::fstream& file, const attribute_& actual, bool is_update = true)
+        static void write_attribute(std::ostream& file, const attribute_& actual, bool is_update = true)
         {
             auto cur = file.tellp();
 
@@ -508,24 +1137,22 @@ namespace rv::util::pbo
                 file.seekp(cur);
             }
         }
-        // Reads a single pbo header from the file.
-        // Stream position will reset stream on error.
-        static std::optional<header> read_header(std::fstream& file)
+        // Reads a single pbo header from the in-memory buffer, starting at pos.
+        // buffer is expected to start at file offset 0, the name points into it.
+        // pos is left untouched on error.
+        static std::optional<header> read_header(std::string_view buffer, size_t& pos)
         {
-            auto start_pos = file.tellg();
-
-            // Cut off version of a3::header
-
+            auto cur = pos;
 
             // Get filename
-            auto name = read_string(file);
+            auto name = read_string(buffer, cur);
             if (!name.has_value()) { return {}; }
-            header::bin data_mapped;
-
-            // read in the whole data available into helper struct
-            file.read(reinterpret_cast<char*>(&data_mapped), sizeof(header::bin));
-            file.clear();
+            if (buffer.size() - cur < sizeof(header::bin)) { return {}; }
 
+            // copy the data available into helper struct
+            header::bin data_mapped;
+            std::memcpy(&data_mapped, buffer.data() + cur, sizeof(header::bin));
+            cur += sizeof(header::bin);
 
             header actual;
 
@@ -551,17 +1178,85 @@ namespace rv::util::pbo
             actual.size_original = data_mapped.size_original;
             actual.size = data_mapped.size;
             actual.timestamp = data_mapped.timestamp;
-            actual.block_entry.start = start_pos;
-            actual.block_entry.end = file.tellg();
+            actual.block_entry.start = std::streamoff(pos);
+            actual.block_entry.end = std::streamoff(cur);
+            pos = cur;
             return actual;
         }
+        // Result of read_table
+        enum class table_result
+        {
+            // Attributes and headers were read completely
+            done,
+            // The buffer ended before the header terminator was reached
+            incomplete,
+            // The buffer does not contain a valid table
+            corrupted
+        };
+        // Reads the version header, all attributes and all headers from an in-memory buffer
+        // starting at file offset 0 into m_attributes and m_headers.
+        //
+        // Remarks:
+        // - On success, pos points to the start of the data section.
+        // - Names, keys and values are copied into m_names, which is cleared first.
+        //   The indices are cleared as well, as they point into it.
+        table_result read_table(std::string_view buffer, size_t& pos)
+        {
+            m_attributes.clear();
+            m_headers.clear();
+            m_header_index.clear();
+            m_attribute_index.clear();
+            m_names.clear();
+            pos = 0;
+
+            // Read in version header
+            if (!read_header(buffer, pos).has_value())
+            {
+                return table_result::incomplete;
+            }
+
+            // Read in attributes until we hit a "no value"
+            std::optional<attribute_> opt_attribute;
+            while ((opt_attribute = read_attribute(buffer, pos)).has_value())
+            {
+                auto& attribute = m_attributes.emplace_back(*opt_attribute);
+                attribute.key = m_names.intern(attribute.key);
+                attribute.value = m_names.intern(attribute.value);
+            }
+            attribute_ attribute_empty = {};
+            attribute_empty.block.start = std::streamoff(pos);
+            attribute_empty.block.end = attribute_empty.block.start + std::streamsize(1);
+            m_attributes.push_back(attribute_empty);
+
+            // Confirm we reached attributes end
+            if (pos >= buffer.size() || buffer[pos] != '\0')
+            { // Attribute or terminator is not inside of the buffer
+                return table_result::incomplete;
+            }
+            pos++;
+
+            // Read in headers until we hit a header with "no value"
+            std::optional<header> opt_header;
+            while ((opt_header = read_header(buffer, pos)).has_value() && !opt_header->name.empty())
+            {
+                m_headers.push_back(*opt_header);
+                m_headers.back().name = m_names.intern(opt_header->name);
+            }
+            if (!opt_header.has_value())
+            {
+                return table_result::incomplete;
+            }
+            m_headers.push_back(*opt_header);
+            m_headers.back().name = {};
+            return table_result::done;
+        }
         // Writes a single pbo header to the file stream where header::data_entry.start refers to.
         // 
         // Remakrs:
         // - is_update: true
         //   - Auto-Reset on end
         //   - Auto-Seek to header on start
-        static void write_header(std::fstream& file, const header& actual, bool is_update = true)
+        static void write_header(std::ostream& file, const header& actual, bool is_update = true)
         {
             auto cur = file.tellp();
 
@@ -617,99 +1312,15 @@ namespace rv::util::pbo
                 file.seekp(cur);
             }
         }
-        // Moves the data from A to B
+        // Moves the data in [old_start, old_end) to new_start, where both ranges may overlap.
+        //
+        // Returns true on success.
         //
         // Remarks:
-        // - If data overlaps, only half of buffsize is used
-        template<size_t buffsize>
-        static void copy(std::fstream& file, std::streampos old_start, std::streampos old_end, std::streampos new_start)
+        // - See move_range()
+        bool copy(std::fstream& file, std::streampos old_start, std::streampos old_end, std::streampos new_start) const
         {
-            if (old_start == new_start) { return; }
-            if (old_start == old_end) { return; }
-            // Get current position so we can seek back later
-            std::streampos cur = file.tellp();
-
-            // Check if new start intersects with old data
-            bool intersects = new_start >= old_start && old_end >= new_start;
-
-            // Seek to start
-            file.seekp(old_start, std::ios::beg);
-            std::streampos source_cur = old_start;
-            std::streampos target_cur = new_start;
-            char buff[buffsize];
-
-            if (intersects)
-            {
-                // Strategy:
-                //   Only ever copy half of the data,
-                //   read in other half ahead of time.
-                bool flip = false;
-                const size_t buffsize_half = buffsize / 2;
-
-                // Read in initial
-                size_t old_read_len = buffsize_half < (old_end - source_cur) ? buffsize_half : (old_end - source_cur);
-                file.seekg(source_cur);
-                file.read(buff, old_read_len);
-                file.clear();
-                source_cur = file.tellg();
-                flip = true;
-
-                while (source_cur < old_end)
-                {
-                    auto remaining = old_end - source_cur;
-                    auto read_len = buffsize_half < remaining ? buffsize_half : remaining;
-
-                    // Read in ahead, flipping the buffer part used each time
-                    file.seekg(source_cur);
-                    file.read(buff + ((flip ? 1 : 0) * buffsize_half), read_len);
-                    file.clear();
-                    source_cur = file.tellg();
-                    flip = !flip;
-
-                    // Write out current at end
-                    file.seekp(target_cur);
-                    file.write(buff + ((flip ? 1 : 0) * buffsize_half), old_read_len);
-                    target_cur = file.tellp();
-
-                    old_read_len = read_len;
-                }
-
-                // Write out last flip if needed
-                if (old_read_len > 0)
-                {
-                    flip = !flip;
-                    file.seekp(target_cur);
-                    file.write(buff + ((flip ? 1 : 0) * buffsize_half), old_read_len);
-                }
-            }
-            else
-            {
-                const size_t buffsize = 512;
-                char buff[buffsize];
-                std::streampos source_cur = old_start;
-                while (source_cur < old_end)
-                {
-                    auto remaining = old_end - source_cur;
-                    auto read_len = buffsize < remaining ? buffsize : remaining;
-
-                    // Read in current
-                    file.seekg(source_cur);
-                    file.read(buff, read_len);
-                    file.clear();
-                    source_cur = file.tellg();
-
-                    // Write out current at end
-                    file.seekp(target_cur);
-                    file.write(buff, read_len);
-                    target_cur = file.tellp();
-                }
-            }
-
-            // Seek back to where we have been
-            file.seekp(cur);
-#if _DEBUG
-            file.flush();
-#endif
+            return move_range(m_path, file, old_start, old_end, new_start);
         }
         // Rewrites the name of the provided header into being an empty-section name
         //
@@ -721,8 +1332,8 @@ namespace rv::util::pbo
             std::streampos cur = file.tellp();
 
             file.seekp(h.block_entry.start);
-            h.name = std::string(h.name.length(), '?');
-            file.write(h.name.data(), h.name.length());
+            std::string name(h.name.length(), '?');
+            file.write(name.data(), name.length());
 
             // Seek back to where we have been
             file.seekp(cur);
@@ -736,13 +1347,11 @@ namespace rv::util::pbo
             using namespace std::string_view_literals;
             if (m_headers.size() == 1) { return true; }
             size_t available = 0;
-            // Check if additional data is required for the resize operation, inserting the empty header
-            for (auto it = m_headers.begin(); it != m_headers.end() - /* empty header */ 1 && available < bytes; it++)
+            // Check if additional data is required for the resize operation, inserting the empty header.
+            // Only empty sections at the very front can be taken over by the table.
+            for (auto it = m_headers.begin(); it != m_headers.end() - /* empty header */ 1 && available < bytes && it->is_invalid(); it++)
             {
-                if (it->is_invalid())
-                {
-                    available += it->block_data.length();
-                }
+                available += it->block_data.length();
             }
             if (available < bytes)
             {
@@ -751,11 +1360,66 @@ namespace rv::util::pbo
                 {
                     return false;
                 }
-                ensure_space_header__free_space_for_headers(file, bytes, available);
+                ensure_space_header(file, bytes);
                 return true;
             }
             return true;
         }
+        // Asks the file system to insert at least bytes at offset (FALLOC_FL_INSERT_RANGE),
+        // moving everything behind further back by only changing metadata.
+        //
+        // Returns the amount of bytes inserted, rounded up to the block size of the file system.
+        // Returns 0 if not supported, which is the case for anything but Linux on ext4 and xfs, mostly.
+        //
+        // Remarks:
+        // - What is in front of offset stays in place.
+        std::streamoff insert_range(std::fstream& file, std::streampos offset, std::streamoff bytes)
+        {
+#if defined(__linux__)
+            file.flush();
+            int fd = ::open(m_path.c_str(), O_RDWR | O_CLOEXEC);
+            if (fd >= 0)
+            {
+                struct stat st;
+                if (::fstat(fd, &st) == 0 && st.st_blksize > 0 && std::streamoff(offset) < std::streamoff(st.st_size))
+                {
+                    std::streamoff block = st.st_blksize;
+                    std::streamoff aligned = std::streamoff(offset) / block * block;
+                    std::streamoff length = (bytes + block - 1) / block * block;
+                    if (::fallocate(fd, FALLOC_FL_INSERT_RANGE, aligned, length) == 0)
+                    {
+                        ::close(fd);
+                        // Offsets need to be block aligned, restore what got moved along in front of offset
+                        copy(file, aligned + length, std::streamoff(offset) + length, aligned);
+                        m_growth = growth_method::insert_range;
+                        return length;
+                    }
+                }
+                ::close(fd);
+            }
+#endif
+            return 0;
+        }
+        // Moves everything from offset up to end further back by at least bytes,
+        // keeping what is in front of offset in place.
+        //
+        // Returns the amount of bytes everything got moved by.
+        //
+        // Remarks:
+        // - Tries insert_range first, falling back to copy<>.
+        // - Everything behind end is moved along too when inserting, but may be overwritten when copying.
+        // - The path taken is reported by last_growth().
+        std::streamoff shift_data(std::fstream& file, std::streampos offset, std::streampos end, std::streamoff bytes)
+        {
+            auto inserted = insert_range(file, offset, bytes);
+            if (inserted > 0)
+            {
+                return inserted;
+            }
+            copy(file, offset, end, offset + bytes);
+            m_growth = growth_method::copy;
+            return bytes;
+        }
         // Ensures that the datasection has at least the provided amount of bytes available.
         // If there are no headers (yet), method is returning immediate.
         void ensure_space_header(std::fstream& file, size_t bytes)
@@ -763,13 +1427,16 @@ namespace rv::util::pbo
             using namespace std::string_view_literals;
             if (m_headers.size() == 1) { return; }
             size_t available = 0;
-            // Check if additional data is required for the resize operation, inserting the empty header
-            for (auto it = m_headers.begin(); it != m_headers.end() - /* empty header */ 1 && available < bytes; it++)
+            // Check if additional data is required for the resize operation, inserting the empty header.
+            // Only empty sections at the very front can be taken over by the table.
+            for (auto it = m_headers.begin(); it != m_headers.end() - /* empty header */ 1 && available < bytes && it->is_invalid(); it++)
             {
-                if (it->is_invalid())
-                {
-                    available += it->block_data.length();
-                }
+                available += it->block_data.length();
+            }
+            if (available < bytes && shrink_table(file) > 0)
+            { // Freed table bytes went to the leading empty section
+                ensure_space_header(file, bytes);
+                return;
             }
             if (available < bytes)
             {
@@ -779,24 +1446,93 @@ namespace rv::util::pbo
 #endif
             }
         }
-        // Helper method of ensure_space_header parameter overloads.
-        // Not intended to be called by itself.
-        void ensure_space_header__write_empty_section(std::fstream& file, std::streamsize freed)
+        // Merges each run of empty sections into a single one with a single character name,
+        // handing the table bytes freed to the leading empty section.
+        //
+        // Returns the amount of bytes freed, 0 if the table was left untouched.
+        //
+        // Remarks:
+        // - No data is moved, the whole table is rewritten at once.
+        // - Invalidates iterators of m_headers.
+        std::streamoff shrink_table(std::fstream& file)
         {
-            using namespace std::string_view_literals;
-            // Check if first header already is empty section
-            if (m_headers.front().is_invalid())
+            std::vector<header> shrunk;
+            shrunk.reserve(m_headers.size() + 1);
+            for (auto& it : m_headers)
             {
-                m_headers.front().block_data.start -= std::streampos(freed);
-                write_header(file, m_headers.front());
+                if (!it.is_invalid())
+                {
+                    shrunk.push_back(it);
+                }
+                else if (!shrunk.empty() && shrunk.back().is_invalid())
+                {
+                    shrunk.back().size += it.size;
+                }
+                else
+                {
+                    shrunk.push_back(it);
+                    shrunk.back().name = "?";
+                }
             }
-            else
+            // Empty sections without data are of no use, unless leading
+            shrunk.erase(std::remove_if(shrunk.begin() + 1, shrunk.end(), [](const header& h) -> bool { return h.is_invalid() && h.size == 0; }), shrunk.end());
+            if (!shrunk.front().is_invalid())
             {
-                // Move all data by the header offset physically
-                auto header_off = sizeof(header::bin) + "?????\0"sv.length();
-                copy<4096>(file,
-                    m_headers.begin()->block_entry.start,
-                    (m_headers.end() - 2)->block_entry.end,
+                header leading = {};
+                leading.name = "?";
+                leading.method = packing_method::none;
+                shrunk.insert(shrunk.begin(), leading);
+            }
+            std::streamoff table_start = m_headers.front().block_entry.start;
+            std::streamoff freed = m_headers.back().block_entry.end - table_start;
+            for (auto& it : shrunk)
+            {
+                freed -= std::streamoff(it.bytes());
+            }
+            if (freed <= 0)
+            {
+                return 0;
+            }
+            shrunk.front().size += uint32_t(freed);
+            m_headers = std::move(shrunk);
+
+            std::ostringstream table;
+            auto offset = table_start;
+            for (auto& it : m_headers)
+            {
+                it.block_entry.start = offset;
+                offset += std::streamoff(it.bytes());
+                it.block_entry.end = offset;
+                write_header(table, it, false);
+            }
+            layout_data();
+            auto rendered = table.str();
+            auto cur = file.tellp();
+            file.seekp(table_start);
+            file.write(rendered.data(), std::streamsize(rendered.size()));
+            file.seekp(cur);
+            index_headers();
+            return freed;
+        }
+        // Helper method of ensure_space_header parameter overloads.
+        // Not intended to be called by itself.
+        void ensure_space_header__write_empty_section(std::fstream& file, std::streamsize freed)
+        {
+            using namespace std::string_view_literals;
+            // Check if first header already is empty section
+            if (m_headers.front().is_invalid())
+            {
+                m_headers.front().block_data.start -= std::streampos(freed);
+                m_headers.front().size = uint32_t(m_headers.front().block_data.length());
+                write_header(file, m_headers.front());
+            }
+            else
+            {
+                // Move all data by the header offset physically
+                auto header_off = sizeof(header::bin) + "?????\0"sv.length();
+                copy(file,
+                    m_headers.begin()->block_entry.start,
+                    (m_headers.end() - 2)->block_entry.end,
                     m_headers.begin()->block_entry.start + std::streampos(header_off));
 
                 // Insert empty header to start
@@ -804,7 +1540,8 @@ namespace rv::util::pbo
                 freed_section.name = "?????";
                 freed_section.block_data.start = m_headers.front().block_data.start - std::streampos(freed - header_off);
                 freed_section.block_data.end = freed_section.block_data.start + std::streampos(freed - header_off);
-                freed_section.block_entry = m_headers.front().block_entry;
+                freed_section.block_entry.start = m_headers.front().block_entry.start;
+                freed_section.block_entry.end = freed_section.block_entry.start + std::streamoff(freed_section.bytes());
                 freed_section.method = packing_method::none;
                 freed_section.size = uint32_t(freed_section.block_data.length());
                 freed_section.timestamp = uint32_t(std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count());
@@ -850,44 +1587,43 @@ namespace rv::util::pbo
                 }
             }
             std::streamsize freed = 0;
+            // Room inserted by the file system comes for free, moving entries to the end does not
+            auto shifted = insert_range(file, m_headers.begin()->block_data.start, bytes);
             // Check if all data needs to be moved plus extra space or just some entries need to be moved to the end
-            if (freed_data < bytes)
+            if (shifted == 0 && freed_data < bytes)
             {
                 // Move everything by `size`
-                copy<4096>(file,
+                shifted = shift_data(file,
                     m_headers.begin()->block_data.start,
                     (m_headers.end() - 2)->block_data.end,
-                    m_headers.begin()->block_data.start + std::streampos(bytes));
+                    bytes);
+            }
+            if (shifted > 0)
+            {
                 for (auto& it : m_headers)
                 {
-                    it.block_data.start += bytes;
-                    it.block_data.end += bytes;
+                    it.block_data.start += shifted;
+                    it.block_data.end += shifted;
                     write_header(file, it);
                 }
-                freed = bytes;
+                freed = shifted;
                 ensure_space_header__write_empty_section(file, freed);
             }
             else
             { // Just copy to end until we reached the required space
+                m_growth = growth_method::copy;
                 auto iter = m_headers.begin();
-                auto old_capacity = m_headers.capacity();
-                auto eof = file.tellp();
-                {
-                    auto tmp = eof;
-                    file.seekp(0, std::ios::end);
-                    eof = file.tellp();
-                    file.seekp(tmp);
-                }
+                std::streampos eof = data_end();
+                std::streampos table_start = m_headers.front().block_entry.start;
 
                 // Skip all empty sections
                 while (iter->is_invalid())
                 {
-                    if (iter->is_invalid()) { continue; }
                     iter++;
                 }
+                auto leading_empty_sections = iter - m_headers.begin();
 
                 // Move to end until available is satisfied
-                auto first_moved_header_iter = iter;
                 while (available < bytes)
                 {
                     // Append moved bytes to available
@@ -895,54 +1631,47 @@ namespace rv::util::pbo
                     freed += iter->block_data.length();
 
                     // Copy data to end
-                    copy<4096>(file, iter->block_data.start, iter->block_data.end, eof);
+                    copy(file, iter->block_data.start, iter->block_data.end, eof);
 
                     // Update block_data offsets
                     auto delta = eof - iter->block_data.start;
                     iter->block_data.start += delta;
                     iter->block_data.end += delta;
+                    eof = iter->block_data.end;
 
                     // Progress iterator
                     ++iter;
                 }
-                auto last_moved_header_iter = iter;
-                
-                // Set target to last header start (gets updated once at the very end too)
-                auto move_delta_end = (m_headers.end() - 2)->block_entry.start - first_moved_header_iter->block_entry.start;
-                auto move_delta_start = (last_moved_header_iter - 1)->block_entry.start - first_moved_header_iter->block_entry.start;
 
-                // Rewrite the moved virtually to end
-                for (; first_moved_header_iter != last_moved_header_iter; first_moved_header_iter++)
-                {
-                    first_moved_header_iter->block_entry.start += move_delta_end;
-                    first_moved_header_iter->block_entry.end += move_delta_end;
-                }
-                // Rewrite the non-moved (but empty) to start
-                for (; last_moved_header_iter != m_headers.end() - 1; last_moved_header_iter++)
+                // Sort virtual representation, moved headers are last now
+                std::stable_sort(m_headers.begin(), m_headers.end() - /* empty header */ 1);
+
+                // Lay out the table in its new order
+                for (auto& it : m_headers)
                 {
-                    auto delta = last_moved_header_iter->block_entry.start - move_delta_start;
-                    last_moved_header_iter->block_entry.start -= delta;
-                    last_moved_header_iter->block_entry.end -= delta;
+                    it.block_entry.start = table_start;
+                    it.block_entry.end = table_start + std::streamoff(it.bytes());
+                    table_start = it.block_entry.end;
                 }
-                // Rewrite empty header to very end
-                first_moved_header_iter--;
-                auto move_target_empty = first_moved_header_iter->block_entry.end;
-                m_headers.back().block_entry.end = move_target_empty + std::streamsize(m_headers.back().block_entry.length());
-                m_headers.back().block_entry.start = move_target_empty;
-
-                // Sort virtual representation
-                std::sort(m_headers.begin(), m_headers.end() - /* empty header */ 1);
 
-                // Invalidates iterators potentially
-                ensure_space_header__write_empty_section(file, freed);
-                if (m_headers.front().is_invalid())
+                if (leading_empty_sections > 0)
+                { // The freed data directly follows the last leading empty section
+                    auto& section = m_headers[leading_empty_sections - 1];
+                    section.block_data.end += freed;
+                    section.size = uint32_t(section.block_data.length());
+                }
+                else
+                { // Invalidates iterators potentially
+                    ensure_space_header__write_empty_section(file, freed);
+                }
+                for (auto& it : m_headers)
                 {
-                    for (auto& it : m_headers)
-                    {
-                        write_header(file, it);
-                    }
+                    write_header(file, it);
                 }
             }
+            // Headers may have been reordered or inserted
+            layout_data();
+            index_headers();
         }
         // Ensures that the attribute_ section has at least the provided amount of bytes available.
         // If there are no headers (yet), method is returning immediate.
@@ -950,14 +1679,7 @@ namespace rv::util::pbo
         {
             using namespace std::string_view_literals;
             if (m_headers.size() == 1) { return true; }
-            size_t available = 0;
-            for (auto it = m_attributes.rbegin(); it != m_attributes.rend() && available < bytes; it++)
-            {
-                if (it->is_invalid())
-                {
-                    available += it->key.length();
-                }
-            }
+            size_t available = attributes_available();
             if (available < bytes)
             {
                 std::fstream file(m_path, std::ios_base::binary | std::ios_base::in | std::ios_base::out);
@@ -973,29 +1695,37 @@ namespace rv::util::pbo
         [[nodiscard]] void ensure_space_attributes(std::fstream& file, size_t bytes)
         {
             using namespace std::string_view_literals;
-            size_t available = 0;
-            for (auto it = m_attributes.rbegin(); it != m_attributes.rend() && available < bytes; it++)
-            {
-                if (it->is_invalid())
-                {
-                    available += it->key.length();
-                }
-            }
+            size_t available = attributes_available();
             if (available < bytes)
             {
                 ensure_space_attributes__free_space_for_attributes(file, bytes, available);
             }
         }
+        // Amount of bytes push_back(attribute_) can take over from the empty section
+        // right in front of the attribute terminator.
+        //
+        // Remarks:
+        // - One character of its name is always kept, so the empty section stays valid.
+        size_t attributes_available() const
+        {
+            if (m_attributes.size() < 2 || !(m_attributes.end() - 2)->is_invalid())
+            {
+                return 0;
+            }
+            return (m_attributes.end() - 2)->key.length() - 1;
+        }
         // Helper method of ensure_space_attributes parameter overloads.
         // Not intended to be called by itself.
         [[nodiscard]] void ensure_space_attributes__free_space_for_attributes(std::fstream& file, std::streamsize bytes, std::streamsize available)
         {
+            // Account for the terminating zeros and the name character kept
+            bytes += 3;
             if (bytes < 1024) { bytes = 1024; }
 
-            copy<8192>(file,
+            bytes = shift_data(file,
                 m_headers.front().block_entry.start,
-                m_headers.back().block_data.end,
-                m_headers.front().block_entry.start + std::streampos(bytes));
+                data_end(),
+                bytes);
             for (auto& it : m_headers)
             {
                 it.block_data.start += bytes;
@@ -1007,13 +1737,32 @@ namespace rv::util::pbo
 
             attribute_ created;
             created.value = "";
-            created.key = std::string(bytes - /* terminating zeros */ 2, '?');
+            created.key = m_names.intern(bytes - /* terminating zeros */ 2, '?');
             created.block.start = m_attributes.back().block.start;
             created.block.end = m_attributes.back().block.start + std::streampos(bytes);
             m_attributes.insert(m_attributes.end() - 1, created);
             write_attribute(file, created);
             m_attributes.back().block.start = created.block.end;
             m_attributes.back().block.end = m_attributes.back().block.start + std::streamsize(1);
+
+            // Write out the moved attribute terminator
+            auto cur = file.tellp();
+            file.seekp(m_attributes.back().block.start);
+            file.write("\0", 1);
+            file.seekp(cur);
+        }
+        // Recalculates the data offsets of all headers from their order and sizes, like open() does.
+        // Needs to be called whenever the table grew or got reordered, as emptied sections
+        // and files without data have to move along.
+        void layout_data()
+        {
+            std::streamoff offset = m_headers.back().block_entry.end;
+            for (auto& it : m_headers)
+            {
+                it.block_data.start = offset;
+                offset += it.size;
+                it.block_data.end = offset;
+            }
         }
         // Adds the header virtually and physically at the very end of the headers list.
         //
@@ -1042,7 +1791,7 @@ namespace rv::util::pbo
 
             // If front is empty section, move its data back further
             size_t rem = h.bytes();
-            for (auto& it = m_headers.begin(); it != m_headers.end() && rem > 0 && it->is_invalid(); ++it)
+            for (auto it = m_headers.begin(); it != m_headers.end() && rem > 0 && it->is_invalid(); ++it)
             {
                 if (it->size > 0)
                 {
@@ -1065,6 +1814,7 @@ namespace rv::util::pbo
             m_headers.back().block_entry.start = h.block_entry.end;
             m_headers.back().block_entry.end = m_headers.back().block_entry.start + std::streampos(m_headers.back().bytes());
             write_header(file, m_headers.back());
+            layout_data();
 
             // Update created block_data
             {
@@ -1075,7 +1825,12 @@ namespace rv::util::pbo
             }
 
             // Insert right before empty-header
-            return m_headers.insert(m_headers.end() - /* empty header */ 1, h);
+            auto inserted = m_headers.insert(m_headers.end() - /* empty header */ 1, h);
+            if (!h.name.empty() && !h.is_invalid())
+            {
+                m_header_index.emplace(index_key(h.name), size_t(inserted - m_headers.begin()));
+            }
+            return inserted;
         }
         // Adds the header virtually and physically at the very end of the headers list.
         //
@@ -1102,27 +1857,12 @@ namespace rv::util::pbo
             // Ensure we have the space available to insert the header to end
             ensure_space_attributes(file, m.bytes());
 
-            // If back is empty section, move its data forward
-            size_t rem = m.bytes();
-            auto start = (m_attributes.end() - 2)->block.start;
-            for (auto& it = m_attributes.rbegin() + 1; it != m_attributes.rend() && rem > 0 && it->is_invalid(); ++it)
-            {
-                if (!it->key.empty())
-                {
-                    auto reduce = rem < it->key.length() ? rem : it->key.length();
-                    rem -= reduce;
-                    it->block.start = it->block.start + std::streampos(reduce);
-                    it->key.resize(it->key.size() - reduce);
-                }
-                if (!it->value.empty() && rem > 0)
-                {
-                    auto reduce = rem < it->value.length() ? rem : it->value.length();
-                    rem -= reduce;
-                    it->block.start = it->block.start + std::streampos(reduce);
-                    it->value.resize(it->value.size() - reduce);
-                    write_attribute(file, *it);
-                }
-            }
+            // Take over the front of the empty section, which is in front of the terminator now.
+            // What remains of its name on disk still forms a valid empty section.
+            auto& section = *(m_attributes.end() - 2);
+            auto start = section.block.start;
+            section.block.start = section.block.start + std::streamoff(m.bytes());
+            section.key = section.key.substr(0, section.key.size() - m.bytes());
 
             // Set block_entry
             m.block.start = start;
@@ -1132,331 +1872,3041 @@ namespace rv::util::pbo
             write_attribute(file, m);
 
             // Insert right before empty-section-attribute_
-            return m_attributes.insert(m_attributes.end() - /* empty header */ 2, m);
-        }
-    public:
-        pbofile() : m_good(false)
-        {
-        }
-        pbofile(std::filesystem::path p) : m_good(false)
-        {
-            if (std::filesystem::exists(p))
-            {
-                open(p);
-            }
-            else
+            auto inserted = m_attributes.insert(m_attributes.end() - /* empty header */ 2, m);
+            if (!m.key.empty() && !m.is_invalid())
             {
-                create(p);
+                m_attribute_index.emplace(m.key, size_t(inserted - m_attributes.begin()));
             }
+            return inserted;
         }
-        bool good() const { return m_good; }
-
-        // // Will rearrange the files inside of the PBO, removing any free datablock
-        // void defragment()
-        // {
-        //     // ToDo
-        // }
-
-        // Opens the provided PBO file
-        void open(const std::filesystem::path &path)
+        // Moves the data of the provided file into a new header at the very end,
+        // turning the old header into an empty section.
+        //
+        // Returns the new header.
+        //
+        // Remarks:
+        // - Invalidates iterators of m_headers.
+        std::vector<header>::iterator move_to_end(std::fstream& file, std::string_view name)
         {
-            std::fstream file(path, std::ios_base::binary | std::ios_base::in | std::ios_base::out);
-            if (!file.is_open() && !file.good())
-            {
-                m_good = false;
-                return;
-            }
-            m_path = path;
-#if _DEBUG
-            auto DBG_POS = file.tellg();
-#endif
-
-            // Read in version header
-            std::optional<header> opt_header = read_header(file);
-            if (!opt_header.has_value())
+            auto iter = m_headers.begin() + find_index(name)->second;
+            // Create new header for copied data, rewrite data section to end
+            std::vector<header>::iterator iter_created;
             {
-                m_good = false;
-                return;
+                header created = *iter;
+                created.timestamp = (uint32_t)std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+                created.block_entry = { 0, 0 };
+                iter_created = push_back(file, created);
             }
-#if _DEBUG
-            DBG_POS = file.tellg();
-#endif
 
+            // Update possibly invalidated iterator
+            iter = m_headers.begin() + find_index(name)->second;
 
-            // Read in attributes until we hit a "no value"
-            std::optional<attribute_> opt_attribute;
-            while ((opt_attribute = read_attribute(file)).has_value())
-            {
-                m_attributes.push_back(*opt_attribute);
-            }
-            attribute_ attribute_empty = {};
-            attribute_empty.block.start = file.tellg();
-            attribute_empty.block.end = attribute_empty.block.start + std::streamsize(1);
-            m_attributes.push_back(attribute_empty);
-#if _DEBUG
-            DBG_POS = file.tellg();
-#endif
+            // Get EOF
+            file.seekg(0, std::ios::end);
+            auto eof = file.tellp();
 
-            // Confirm we reached attributes end
-            if (file.get() != '\0')
-            { // we failed :(
-                m_good = false;
-                return;
-            }
-#if _DEBUG
-            DBG_POS = file.tellg();
-#endif
+            // Copy data to end
+            copy(file, iter->block_data.start, iter->block_data.end, eof);
 
+            // Update created data
+            iter_created->block_data.start = eof;
+            iter_created->block_data.end = eof + (iter->block_data.end - iter->block_data.start);
+            write_header(file, *iter_created);
 
-            // Read in headers until we hit a header with "no value"
-            while ((opt_header = read_header(file)).has_value() && !opt_header->name.empty())
+            // Rename old header to represent empty section
+            iter->name = m_names.intern(iter->name.length(), '?');
+            write_header(file, *iter);
+            find_index(name)->second = size_t(iter_created - m_headers.begin());
+            return iter_created;
+        }
+        // Inserts an empty section without data directly behind the provided file,
+        // allowing it to shrink without moving the data following it.
+        //
+        // Returns the header of the file.
+        //
+        // Remarks:
+        // - If making room in the table moves the file to the end, nothing is inserted.
+        // - Invalidates iterators of m_headers.
+        std::vector<header>::iterator insert_empty_section(std::fstream& file, std::string_view name)
+        {
+            header section = {};
+            section.name = "?";
+            section.method = packing_method::none;
+            ensure_space_header(file, section.bytes());
+            auto index = find_index(name)->second;
+            if (index + 1 == m_headers.size() - /* empty header */ 1)
             {
-                m_headers.push_back(*opt_header);
+                return m_headers.begin() + index;
             }
-            m_headers.push_back(*opt_header);
-#if _DEBUG
-            DBG_POS = file.tellg();
-#endif
-
 
-            auto offset = file.tellg();
-            // Add data-sections to headers
-            for (auto &it : m_headers)
+            // The table grows into the leading empty sections
+            std::streamoff rem = std::streamoff(section.bytes());
+            for (auto it = m_headers.begin(); rem > 0 && it->is_invalid(); ++it)
             {
-                it.block_data.start = offset;
-                offset += it.size;
-                it.block_data.end = offset;
+                auto reduce = std::min<std::streamoff>(rem, it->size);
+                rem -= reduce;
+                it->size -= uint32_t(reduce);
             }
+            m_headers.insert(m_headers.begin() + index + 1, section);
 
-            // All fine here, end processing.
-            m_good = true;
-        }
-        // Creates a new, empty PBO file
-        void create(const std::filesystem::path& path)
-        {
-            std::fstream file(path, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
-            if (!file.is_open() && !file.good())
+            // Lay out and write the table at once
+            std::streamoff offset = m_headers.front().block_entry.start;
+            auto table_start = offset;
+            std::ostringstream table;
+            for (auto& it : m_headers)
             {
-                m_good = false;
-                return;
+                it.block_entry.start = offset;
+                offset += std::streamoff(it.bytes());
+                it.block_entry.end = offset;
+                write_header(table, it, false);
             }
-            m_path = path;
-            header version = {};
-            version.method = packing_method::version;
-            write_header(file, version, false);
-#ifdef _DEBUG
-            file.flush();
-#endif
-
-            attribute_ attribute_empty = {};
-            attribute_empty.block.start = file.tellp();
-            file.write("\0", 1);
-#ifdef _DEBUG
-            file.flush();
-#endif
-
-            header header_empty = {};
-            header_empty.block_entry.start = attribute_empty.block.end = file.tellp();
-            write_header(file, { }, false);
-            header_empty.block_data.start = header_empty.block_data.end = header_empty.block_entry.end = file.tellp();
-#ifdef _DEBUG
-            file.flush();
-#endif
-
-            m_attributes.push_back(attribute_empty);
-            m_headers.push_back(header_empty);
-
-            m_good = true;
+            layout_data();
+            auto rendered = table.str();
+            auto cur = file.tellp();
+            file.seekp(table_start);
+            file.write(rendered.data(), std::streamsize(rendered.size()));
+            file.seekp(cur);
+            index_headers();
+            return m_headers.begin() + index;
         }
+        // Minimum amount of data kept in the leading empty sections when allocating from them,
+        // so the table can keep growing without moving data.
+        static constexpr size_t leading_reserve = 1024;
 
-        // Creates a new reader for the provided header file.
-        [[nodiscard]] bool read(std::string_view filename, reader& out_reader) const
+        // Collects the data of all runs of empty sections into m_free_blocks, coalescing neighbours.
+        void collect_free_blocks()
         {
-            if (!good())
-            {
-                return false;
-            }
-            auto res = std::find_if(m_headers.begin(), m_headers.end(), [filename](header h) -> bool {
-                return h.name == filename && !h.is_invalid();
-            });
-            if (res == m_headers.end())
+            m_free_blocks.clear();
+            for (auto it = m_headers.begin(); it != m_headers.end() - /* empty header */ 1; ++it)
             {
-                return false;
+                if (!it->is_invalid())
+                {
+                    continue;
+                }
+                if (it != m_headers.begin() && (it - 1)->is_invalid())
+                {
+                    m_free_blocks.back().end = it->block_data.end;
+                }
+                else
+                {
+                    m_free_blocks.push_back(it->block_data);
+                }
             }
-            return out_reader.initialize(m_path, *res);
         }
-        // Creates a new writer, pointing at the end of this pbo for the provided file.
-        // Behavior is undefined for more then one active writer.
+        // Places a new, empty header into the smallest run of empty sections able to hold capacity bytes.
+        // The run gets replaced by the new header, followed by a single empty section covering its data.
         //
-        // For existing files, actual action happening is:
-        // 1. Copy old contents to the end.
-        // 2. Replace header offsets.
-        // 3. Create fake-header (header::empty_section) refering to the old contents.
-        // 4. Seek writer to start of current file.
-        [[nodiscard]] bool write(std::string_view name, writer& out_writer)
-        {
-            if (!good())
-            {
-                return false;
-            }
-            return out_writer.initialize(this, name);
-        }
-
-        // Returns all available attributes
+        // Returns m_headers.end() if no run is large enough.
         //
         // Remarks:
-        // - Creates a new vector of the current attributes and returns it.
-        std::vector<std::pair<std::string, std::string>> attributes() const
+        // - The leading empty sections are reserved for the table to grow into.
+        //   Only what exceeds leading_reserve is handed out, taken from their end.
+        // - The name of the new empty section takes over the table bytes of the run.
+        //   Only if those are not enough, the table grows (see ensure_space_header).
+        // - Invalidates iterators of m_headers.
+        std::vector<header>::iterator allocate(std::fstream& file, std::string_view name, size_t capacity)
         {
-            std::vector<std::pair<std::string, std::string>> pairs;
-            pairs.reserve(m_attributes.size());
-            for (auto it = m_attributes.begin(); it != m_attributes.end() - 1; ++it)
+            collect_free_blocks();
+            bool has_leading = m_headers.front().is_invalid();
+            auto usable = [&](std::vector<datablock>::const_iterator it) -> size_t
             {
-                if (it->is_invalid())
+                if (it != m_free_blocks.begin() || !has_leading)
                 {
-                    continue;
+                    return it->length();
+                }
+                return it->length() > leading_reserve ? it->length() - leading_reserve : 0;
+            };
+            auto fit = m_free_blocks.end();
+            for (auto it = m_free_blocks.begin(); it != m_free_blocks.end(); ++it)
+            {
+                if (usable(it) >= capacity && (fit == m_free_blocks.end() || usable(it) < usable(fit)))
+                {
+                    fit = it;
                 }
-                pairs.push_back(std::make_pair(it->key, it->value));
             }
-            return pairs;
-        }
-        // Looks up a single attribute and returns it, if it exists.
-        //
-        // Remarks:
-        // - If the attribute is not existing, empty optional will be returned
-        std::optional<std::string> attribute(std::string_view key) const
-        {
-            auto res = std::find_if(m_attributes.begin(), m_attributes.end(), [key](attribute_ att) -> bool { return att.key == key && !att.is_invalid(); });
-            if (res != m_attributes.end())
+            if (fit == m_free_blocks.end())
             {
-                return res->value;
+                return m_headers.end();
             }
-            return {};
-        }
-        // Set a single attribute
-        //
-        // Remarks:
-        // - Always appends attribute
-        // - If attribute already exists, old attribute gets invalidated.
-        // - Can invalidates any open writers/readers
-        [[nodiscard]] bool attribute(std::string_view key, std::string_view value)
-        {
-            std::fstream file(m_path, std::ios_base::binary | std::ios_base::out | std::ios_base::in);
-            if (!file.is_open() && !file.good())
+            bool leading = has_leading && fit == m_free_blocks.begin();
+            // Find the headers of the run. Runs may share their offset with others,
+            // as long as only files without data are in between, so count them instead.
+            auto run = fit - m_free_blocks.begin();
+            size_t first = 0;
+            while (!(m_headers[first].is_invalid() && (first == 0 || !m_headers[first - 1].is_invalid()) && run-- == 0))
             {
-                m_good = false;
-                return false;
+                first++;
             }
-
-            auto res = std::find_if(m_attributes.begin(), m_attributes.end(), [key](attribute_ att) -> bool { return att.key == key; });
-            if (res != m_attributes.end())
+            size_t last = first;
+            while (last < m_headers.size() - /* empty header */ 1 && m_headers[last].is_invalid())
             {
-                // invalidate old attribute
-                std::transform(res->key.begin(), res->key.end(), res->key.begin(), [](char c) -> char { return '?'; });
-                std::transform(res->value.begin(), res->value.end(), res->value.begin(), [](char c) -> char { return '?'; });
-                write_attribute(file, *res);
-
+                last++;
+            }
+            auto timestamp = (uint32_t)std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+            std::vector<header> created(leading ? 3 : 2);
+            for (auto& it : created)
+            {
+                it.name = "?";
+                it.method = packing_method::none;
+                it.timestamp = timestamp;
+            }
+            // Only sizes matter, layout_data() takes care of the offsets
+            auto& placed = created[created.size() - 2];
+            auto& section = created.back();
+            placed.name = m_names.intern(name);
+            section.size = uint32_t(capacity);
+            if (leading)
+            {
+                created.front().size = uint32_t(fit->length() - capacity);
+            }
+            else
+            {
+                section.size = uint32_t(fit->length());
+            }
+
+            std::streamoff run_bytes = m_headers[last].block_entry.start - m_headers[first].block_entry.start;
+            std::streamoff needed = 0;
+            for (auto& it : created)
+            {
+                needed += std::streamoff(it.bytes());
+            }
+            auto grow = std::max<std::streamoff>(needed - run_bytes, 0);
+            section.name = m_names.intern(size_t(std::max<std::streamoff>(run_bytes - needed, 0)) + 1, '?');
+            if (grow > 0 && leading)
+            { // The table grows into the part of the run kept
+                if (created.front().size < uint32_t(grow))
+                {
+                    return m_headers.end();
+                }
+                created.front().size -= uint32_t(grow);
+            }
+            else if (grow > 0)
+            {
+                size_t available = 0;
+                for (auto it = m_headers.begin(); it != m_headers.end() - /* empty header */ 1 && it->is_invalid(); it++)
+                {
+                    available += it->block_data.length();
+                }
+                if (available < size_t(grow))
+                { // Moves data around, start over
+                    ensure_space_header(file, size_t(grow));
+                    return allocate(file, name, capacity);
+                }
+                // The table grows into the leading empty sections
+                auto rem = grow;
+                for (auto it = m_headers.begin(); rem > 0 && it->is_invalid(); ++it)
+                {
+                    auto reduce = std::min<std::streamoff>(rem, it->size);
+                    rem -= reduce;
+                    it->size -= uint32_t(reduce);
+                }
+            }
+
+            // Lay out and write the changed part of the table at once
+            size_t from = grow > 0 ? 0 : first;
+            std::streamoff offset = m_headers[from].block_entry.start;
+            auto table_start = offset;
+            m_headers.erase(m_headers.begin() + first, m_headers.begin() + last);
+            m_headers.insert(m_headers.begin() + first, created.begin(), created.end());
+            std::ostringstream table;
+            for (size_t i = from; i < m_headers.size(); i++)
+            {
+                m_headers[i].block_entry.start = offset;
+                offset += std::streamoff(m_headers[i].bytes());
+                m_headers[i].block_entry.end = offset;
+                write_header(table, m_headers[i], false);
+            }
+            layout_data();
+            auto rendered = table.str();
+            auto cur = file.tellp();
+            file.seekp(table_start);
+            file.write(rendered.data(), std::streamsize(rendered.size()));
+            file.seekp(cur);
+
+            m_free_blocks.erase(fit);
+            index_headers();
+            return m_headers.begin() + first + (leading ? 1 : 0);
+        }
+    public:
+        // Collects changes to a PBO file and applies them all at once on commit().
+        //
+        // Remarks:
+        // - Nothing is written before commit().
+        // - Committing plans the complete layout up front, moves every data section at most once
+        //   and writes the table in a single write, all through a single file handle.
+        // - Dead sections (eg. "?????" placeholders) are dropped on commit.
+        // - Committing invalidates any open writers/readers and removes the trailer.
+        // - Interrupting a commit leaves the file corrupted.
+        class transaction
+        {
+            friend class pbofile;
+            struct staged_file
+            {
+                std::string name;
+                // Contents of files added from memory
+                std::vector<char> data;
+                // Source of files added from disk, empty for files added from memory
+                std::filesystem::path path;
+                size_t size;
+                // Set if the file gets removed
+                bool removed;
+            };
+            pbofile* m_pbo;
+            std::vector<staged_file> m_files;
+            // Maps names to their slot in m_files, normalized in lookup_mode::normalized (see file_key)
+            std::unordered_map<std::string, size_t, name_hash, std::equal_to<>> m_file_index;
+            std::vector<std::pair<std::string, std::optional<std::string>>> m_attributes;
+
+            void initialize(pbofile* pbo)
+            {
+                m_pbo = pbo;
+                rollback();
+            }
+            // Returns the key of the provided name in m_file_index, matching names like the PBO does.
+            std::string file_key(std::string_view name) const
+            {
+                std::string key(name);
+                if (m_pbo->m_lookup == lookup_mode::normalized)
+                {
+                    path_key::normalize(key, key.data());
+                }
+                return key;
+            }
+            // Whether the file exists, taking staged changes into account.
+            bool exists(std::string_view name) const
+            {
+                auto staged = m_file_index.find(file_key(name));
+                if (staged != m_file_index.end())
+                {
+                    return !m_files[staged->second].removed;
+                }
+                return m_pbo->find_header(name) != nullptr;
+            }
+            // Records the change, replacing any earlier change of the same file.
+            void stage(staged_file file)
+            {
+                auto key = file_key(file.name);
+                auto staged = m_file_index.find(key);
+                if (staged != m_file_index.end())
+                {
+                    m_files[staged->second] = std::move(file);
+                    return;
+                }
+                m_file_index.emplace(std::move(key), m_files.size());
+                m_files.push_back(std::move(file));
+            }
+            bool stage_data(std::string_view name, std::string_view data, bool replacing)
+            {
+                if (!good() || !is_valid_file_name(name) || exists(name) != replacing
+                    || data.size() > std::numeric_limits<uint32_t>::max())
+                {
+                    return false;
+                }
+                stage({ std::string(name), std::vector<char>(data.begin(), data.end()), {}, data.size(), false });
+                return true;
+            }
+            bool stage_file(std::string_view name, const std::filesystem::path& path, bool replacing)
+            {
+                if (!good() || !is_valid_file_name(name) || exists(name) != replacing)
+                {
+                    return false;
+                }
+                std::error_code ec;
+                auto size = std::filesystem::file_size(path, ec);
+                if (ec || size > std::numeric_limits<uint32_t>::max())
+                {
+                    return false;
+                }
+                stage({ std::string(name), {}, path, size_t(size), false });
+                return true;
+            }
+        public:
+            transaction() : m_pbo(nullptr) { }
+            // False if the transaction was not started using pbofile::begin.
+            bool good() const { return m_pbo != nullptr && m_pbo->good(); }
+
+            // Adds a new file with the provided contents.
+            //
+            // Returns false if the file already exists.
+            [[nodiscard]] bool add(std::string_view name, std::string_view data) { return stage_data(name, data, false); }
+            // Adds a new file whose contents are read from disk on commit.
+            //
+            // Returns false if the file already exists.
+            //
+            // Remarks:
+            // - The size is taken now, the file must not change until commit() is done.
+            [[nodiscard]] bool add_file(std::string_view name, const std::filesystem::path& path) { return stage_file(name, path, false); }
+            // Replaces the contents of an existing file.
+            //
+            // Returns false if the file does not exist.
+            [[nodiscard]] bool replace(std::string_view name, std::string_view data) { return stage_data(name, data, true); }
+            // Replaces the contents of an existing file with a file read from disk on commit.
+            //
+            // Returns false if the file does not exist.
+            //
+            // Remarks:
+            // - The size is taken now, the file must not change until commit() is done.
+            [[nodiscard]] bool replace_file(std::string_view name, const std::filesystem::path& path) { return stage_file(name, path, true); }
+            // Removes an existing file.
+            //
+            // Returns false if the file does not exist.
+            [[nodiscard]] bool remove(std::string_view name)
+            {
+                if (!good() || !exists(name))
+                {
+                    return false;
+                }
+                stage({ std::string(name), {}, {}, 0, true });
+                return true;
+            }
+            // Sets a single attribute, replacing any previous value.
+            void attribute(std::string_view key, std::string_view value)
+            {
+                for (auto& it : m_attributes)
+                {
+                    if (it.first == key)
+                    {
+                        it.second = std::string(value);
+                        return;
+                    }
+                }
+                m_attributes.emplace_back(std::string(key), std::string(value));
+            }
+            // Removes a single attribute, if it exists.
+            void remove_attribute(std::string_view key)
+            {
+                for (auto& it : m_attributes)
+                {
+                    if (it.first == key)
+                    {
+                        it.second.reset();
+                        return;
+                    }
+                }
+                m_attributes.emplace_back(std::string(key), std::nullopt);
+            }
+            // Discards all staged changes.
+            void rollback()
+            {
+                m_files.clear();
+                m_file_index.clear();
+                m_attributes.clear();
+            }
+            // Applies all staged changes to the PBO file.
+            // The transaction is empty afterwards, no matter the result.
+            //
+            // Returns true on success.
+            [[nodiscard]] bool commit()
+            {
+                bool success = good() && m_pbo->apply(*this);
+                rollback();
+                return success;
+            }
+        };
+    private:
+        // Applies the changes staged in the transaction.
+        //
+        // Remarks:
+        // - Layout is: table, all remaining files in table order, each moved at most once,
+        //   replaced files keep their position in the table.
+        // - Regions moving down are processed front to back, regions moving up back to front.
+        //   That way, no region overwrites another region not moved yet.
+        bool apply(const transaction& tx)
+        {
+            if (!strip_trailer())
+            {
+                return false;
+            }
+            std::fstream file(m_path, std::ios_base::binary | std::ios_base::out | std::ios_base::in);
+            if (!file.is_open() || !file.good())
+            {
+                return false;
+            }
+            auto timestamp = (uint32_t)std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+            // Plan attributes
+            std::vector<attribute_> attributes;
+            for (auto it = m_attributes.begin(); it != m_attributes.end() - 1; ++it)
+            {
+                if (!it->is_invalid())
+                {
+                    attributes.push_back(*it);
+                }
+            }
+            for (auto& [key, value] : tx.m_attributes)
+            {
+                auto existing = std::find_if(attributes.begin(), attributes.end(), [&key](const attribute_& att) -> bool { return att.key == key; });
+                if (existing != attributes.end() && value.has_value())
+                {
+                    existing->value = m_names.intern(*value);
+                }
+                else if (existing != attributes.end())
+                {
+                    attributes.erase(existing);
+                }
+                else if (value.has_value())
+                {
+                    attributes.push_back({ m_names.intern(key), m_names.intern(*value), {} });
+                }
+            }
+
+            // Resolve changes of existing files to their header, matched like find_header() does
+            std::vector<const transaction::staged_file*> changes(m_headers.size(), nullptr);
+            for (auto& change : tx.m_files)
+            {
+                auto existing = find_index(change.name);
+                if (existing != m_header_index.end())
+                {
+                    changes[existing->second] = &change;
+                }
+            }
+
+            // Plan files, keeping track of where their data comes from
+            struct planned
+            {
+                header h;
+                // Current offset of retained files
+                std::streamoff source;
+                // Set for added or replaced files
+                const transaction::staged_file* staged;
+            };
+            std::vector<planned> files;
+            for (auto it = m_headers.begin(); it != m_headers.end() - 1; ++it)
+            {
+                if (it->is_invalid() || it->name.empty())
+                {
+                    continue;
+                }
+                auto staged = changes[size_t(it - m_headers.begin())];
+                if (staged == nullptr)
+                {
+                    files.push_back({ *it, it->block_data.start, nullptr });
+                    continue;
+                }
+                auto& change = *staged;
+                if (change.removed)
+                {
+                    continue;
+                }
+                header h = *it;
+                h.method = packing_method::none;
+                h.size_original = 0;
+                h.size = uint32_t(change.size);
+                h.timestamp = timestamp;
+                files.push_back({ h, 0, &change });
+            }
+            for (auto& change : tx.m_files)
+            {
+                if (change.removed || find_header(change.name) != nullptr)
+                {
+                    continue;
+                }
+                header h = {};
+                h.name = m_names.intern(change.name);
+                h.method = packing_method::none;
+                h.size = uint32_t(change.size);
+                h.timestamp = timestamp;
+                files.push_back({ h, 0, &change });
+            }
+
+            // Open sources from disk before touching anything
+            std::vector<std::ifstream> inputs(files.size());
+            for (size_t i = 0; i < files.size(); i++)
+            {
+                if (files[i].staged == nullptr || files[i].staged->path.empty())
+                {
+                    continue;
+                }
+                inputs[i].open(files[i].staged->path, std::ios_base::binary | std::ios_base::in);
+                if (!inputs[i].is_open() || !inputs[i].good())
+                {
+                    return false;
+                }
+            }
+
+            // Render the table
+            std::ostringstream table;
+            header version = {};
+            version.method = packing_method::version;
+            write_header(table, version, false);
+            for (auto& att : attributes)
+            {
+                att.block.start = table.tellp();
+                write_attribute(table, att, false);
+                att.block.end = table.tellp();
+            }
+            attribute_ attribute_empty = {};
+            attribute_empty.block.start = table.tellp();
+            table.write("\0", 1);
+            attribute_empty.block.end = table.tellp();
+            attributes.push_back(attribute_empty);
+            for (auto& it : files)
+            {
+                it.h.block_entry.start = table.tellp();
+                write_header(table, it.h, false);
+                it.h.block_entry.end = table.tellp();
+            }
+            header header_empty = {};
+            header_empty.block_entry.start = table.tellp();
+            write_header(table, header_empty, false);
+            header_empty.block_entry.end = table.tellp();
+            std::streamoff offset = table.tellp();
+            for (auto& it : files)
+            {
+                it.h.block_data.start = offset;
+                offset += it.h.size;
+                it.h.block_data.end = offset;
+            }
+            header_empty.block_data = { offset, offset };
+
+            // From here on, failing leaves the file in an unknown state
+            auto fail = [this]() -> bool { m_good = false; return false; };
+            std::vector<char> buffer(1024 * 1024);
+            for (auto& it : files)
+            {
+                if (it.staged == nullptr && it.h.block_data.start < it.source && !copy(file, it.source, it.source + std::streamoff(it.h.size), it.h.block_data.start))
+                {
+                    return fail();
+                }
+            }
+            for (auto it = files.rbegin(); it != files.rend(); ++it)
+            {
+                if (it->staged == nullptr && it->h.block_data.start > it->source && !copy(file, it->source, it->source + std::streamoff(it->h.size), it->h.block_data.start))
+                {
+                    return fail();
+                }
+            }
+            for (size_t i = 0; i < files.size(); i++)
+            {
+                if (files[i].staged == nullptr)
+                {
+                    continue;
+                }
+                file.seekp(files[i].h.block_data.start);
+                if (files[i].staged->path.empty())
+                {
+                    file.write(files[i].staged->data.data(), std::streamsize(files[i].staged->data.size()));
+                    continue;
+                }
+                size_t remaining = files[i].staged->size;
+                while (remaining > 0)
+                {
+                    auto chunk = remaining < buffer.size() ? remaining : buffer.size();
+                    inputs[i].read(buffer.data(), std::streamsize(chunk));
+                    if (size_t(inputs[i].gcount()) != chunk)
+                    { // Source shrunk after it was staged
+                        return fail();
+                    }
+                    file.write(buffer.data(), std::streamsize(chunk));
+                    remaining -= chunk;
+                }
+            }
+            auto rendered = table.str();
+            file.seekp(0);
+            file.write(rendered.data(), std::streamsize(rendered.size()));
+            file.flush();
+            if (!file.good())
+            {
+                return fail();
+            }
+            file.close();
+
+            // Update the in-memory state to match
+            m_attributes = std::move(attributes);
+            m_headers.clear();
+            m_headers.reserve(files.size() + 1);
+            for (auto& it : files)
+            {
+                m_headers.push_back(std::move(it.h));
+            }
+            m_headers.push_back(header_empty);
+            m_free_blocks.clear();
+            compact_names();
+            return strip_trailer() || fail();
+        }
+        // State of a journaled update, stored at the start of the journal file.
+        // The journal file continues with the table bytes and two slots of chunk_size bytes each.
+        struct journal_state
+        {
+            char magic[4];
+            // Zero until the journal is complete, nothing needs to be recovered before.
+            uint32_t active;
+            // Data is moved down from old_start to new_start, never up.
+            uint64_t old_start;
+            uint64_t new_start;
+            uint64_t length;
+            // Offset into the moved data of the next chunk to copy.
+            uint64_t next;
+            uint64_t chunk_size;
+            // Slot holding a copy of the chunk at next, or no_slot.
+            // Only used if chunks overlap their own source.
+            uint64_t slot;
+            // Where the table bytes get written to once all data was moved.
+            uint64_t table_offset;
+            uint64_t table_length;
+            // Size the file gets truncated to at the end, or 0 to keep the size.
+            uint64_t truncate_to;
+
+            static constexpr uint64_t no_slot = std::numeric_limits<uint64_t>::max();
+        };
+        static constexpr char journal_magic[4] = { 'r', 'v', 'j', '1' };
+
+        // Path of the journal kept by defragment() next to the provided PBO.
+        static std::filesystem::path journal_path(const std::filesystem::path& path)
+        {
+            auto copy = path;
+            copy += ".defrag";
+            return copy;
+        }
+        // Flushes the provided stream of the file at path and forces everything written to it onto the disk.
+        //
+        // Returns true on success.
+        //
+        // Remarks:
+        // - Flushing the stream alone only hands the data to the operating system, which may write it out
+        //   in any order. Steps of a journaled update rely on earlier steps having reached the disk.
+        static bool sync(std::fstream& stream, const std::filesystem::path& path)
+        {
+            stream.flush();
+            if (!stream.good())
+            {
+                return false;
+            }
+#if defined(_WIN32)
+            auto handle = CreateFileW(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (handle == INVALID_HANDLE_VALUE)
+            {
+                return false;
+            }
+            bool synced = FlushFileBuffers(handle) != 0;
+            CloseHandle(handle);
+            return synced;
+#else
+            int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+            if (fd < 0)
+            {
+                return false;
+            }
+#if defined(__linux__)
+            bool synced = ::fdatasync(fd) == 0;
+#else
+            bool synced = ::fsync(fd) == 0;
+#endif
+            ::close(fd);
+            return synced;
+#endif
+        }
+        // Forces the directory entries of the directory containing path onto the disk,
+        // so a file created or removed next to it stays so.
+        //
+        // Remarks:
+        // - Does nothing on Windows, where FlushFileBuffers covers the metadata of the file.
+        static bool sync_directory(const std::filesystem::path& path)
+        {
+#if defined(_WIN32)
+            (void)path;
+            return true;
+#else
+            auto directory = path.parent_path();
+            int fd = ::open(directory.empty() ? "." : directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (fd < 0)
+            {
+                return false;
+            }
+            bool synced = ::fsync(fd) == 0;
+            ::close(fd);
+            return synced;
+#endif
+        }
+        static bool write_journal_state(std::fstream& journal, const std::filesystem::path& jpath, const journal_state& state)
+        {
+            journal.seekp(0);
+            journal.write(reinterpret_cast<const char*>(&state), sizeof(journal_state));
+            return sync(journal, jpath);
+        }
+        // Moves the remaining data, writes the table and truncates the file as the journal states.
+        // Every copied chunk is recorded before the next one is read, so it may be called again
+        // with the journal contents after being interrupted at any point.
+        //
+        // Remarks:
+        // - A chunk copy reaches the disk before the state points at it, a chunk reaches the PBO
+        //   before the state moves past it. The table is only written once all data is on disk.
+        static bool run_journal(const std::filesystem::path& path, std::fstream& file, std::fstream& journal, journal_state& state, std::vector<char>& buffer)
+        {
+            auto jpath = journal_path(path);
+            auto distance = state.old_start - state.new_start;
+            auto slots_start = std::streamoff(sizeof(journal_state) + state.table_length);
+            bool keep_chunks = state.chunk_size > distance;
+            buffer.resize(std::max<size_t>(buffer.size(), size_t(std::max<uint64_t>(state.chunk_size, state.table_length))));
+            if (keep_chunks && state.slot != journal_state::no_slot && state.next < state.length)
+            { // Chunk at next may be half-written while its source is overwritten already, redo it from the copy
+                auto chunk = std::streamsize(std::min(state.chunk_size, state.length - state.next));
+                journal.seekg(slots_start + std::streamoff(state.slot * state.chunk_size));
+                journal.read(buffer.data(), chunk);
+                if (journal.gcount() != chunk)
+                {
+                    return false;
+                }
+                file.seekp(std::streamoff(state.new_start + state.next));
+                file.write(buffer.data(), chunk);
+                if (!sync(file, path))
+                {
+                    return false;
+                }
+                state.next += uint64_t(chunk);
+            }
+            while (state.next < state.length)
+            {
+                auto chunk = std::streamsize(std::min(state.chunk_size, state.length - state.next));
+                file.seekg(std::streamoff(state.old_start + state.next));
+                file.read(buffer.data(), chunk);
+                if (file.gcount() != chunk)
+                {
+                    return false;
+                }
+                if (keep_chunks)
+                { // Alternate slots, so the previous chunk stays intact until the state points at this one
+                    state.slot = state.next / state.chunk_size % 2;
+                    journal.seekp(slots_start + std::streamoff(state.slot * state.chunk_size));
+                    journal.write(buffer.data(), chunk);
+                    if (!sync(journal, jpath) || !write_journal_state(journal, jpath, state))
+                    {
+                        return false;
+                    }
+                }
+                file.seekp(std::streamoff(state.new_start + state.next));
+                file.write(buffer.data(), chunk);
+                if (!sync(file, path))
+                {
+                    return false;
+                }
+                state.next += uint64_t(chunk);
+                if (!keep_chunks && !write_journal_state(journal, jpath, state))
+                {
+                    return false;
+                }
+            }
+            journal.seekg(std::streamoff(sizeof(journal_state)));
+            journal.read(buffer.data(), std::streamsize(state.table_length));
+            if (journal.gcount() != std::streamsize(state.table_length))
+            {
+                return false;
+            }
+            file.seekp(std::streamoff(state.table_offset));
+            file.write(buffer.data(), std::streamsize(state.table_length));
+            if (!sync(file, path))
+            {
+                return false;
+            }
+            if (state.truncate_to > 0)
+            {
+                std::error_code ec;
+                std::filesystem::resize_file(path, state.truncate_to, ec);
+                if (ec || !sync(file, path))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+        // Moves length bytes down from old_start to new_start and writes table at table_offset afterwards,
+        // optionally truncating the file to truncate_to.
+        // Progress is recorded in a journal next to the file, which open() uses to finish the update
+        // if the process gets interrupted.
+        //
+        // Remarks:
+        // - Extra disk space used is the table plus at most two chunks, independent of length.
+        // - Chunks are only copied into the journal if they overlap their own source.
+        static bool journaled_update(const std::filesystem::path& path, std::fstream& file, std::streamoff old_start, std::streamoff new_start, std::streamoff length,
+            std::streamoff table_offset, std::string_view table, std::streamoff truncate_to, std::vector<char>& buffer)
+        {
+            journal_state state = {};
+            std::memcpy(state.magic, journal_magic, sizeof(journal_magic));
+            state.old_start = uint64_t(old_start);
+            state.new_start = uint64_t(new_start);
+            state.length = uint64_t(length);
+            // Chunks not larger than the distance never overlap their source and need no copy
+            auto distance = uint64_t(old_start - new_start);
+            state.chunk_size = distance >= 64 * 1024 ? std::min<uint64_t>(distance, buffer.size()) : 64 * 1024;
+            state.slot = journal_state::no_slot;
+            state.table_offset = uint64_t(table_offset);
+            state.table_length = table.size();
+            state.truncate_to = uint64_t(truncate_to);
+
+            auto jpath = journal_path(path);
+            std::fstream journal(jpath, std::ios_base::binary | std::ios_base::in | std::ios_base::out | std::ios_base::trunc);
+            if (!journal.is_open() || !journal.good())
+            {
+                return false;
+            }
+            // Only activate the journal once it is complete on disk
+            journal.write(reinterpret_cast<const char*>(&state), sizeof(journal_state));
+            journal.write(table.data(), std::streamsize(table.size()));
+            if (!sync(journal, jpath) || !sync_directory(jpath))
+            {
+                return false;
+            }
+            state.active = 1;
+            if (!write_journal_state(journal, jpath, state) || !run_journal(path, file, journal, state, buffer))
+            {
+                return false;
+            }
+            journal.close();
+            std::error_code ec;
+            std::filesystem::remove(jpath, ec);
+            return !ec && sync_directory(jpath);
+        }
+        // Whether an update interrupted while running from the journal next to the provided PBO is pending.
+        //
+        // Remarks:
+        // - Journals which cannot be read are taken as pending, only recover_journal() can tell.
+        static bool journal_pending(const std::filesystem::path& path)
+        {
+            auto jpath = journal_path(path);
+            std::error_code ec;
+            if (!std::filesystem::exists(jpath, ec))
+            {
+                return bool(ec);
+            }
+            std::ifstream journal(jpath, std::ios_base::binary | std::ios_base::in);
+            if (!journal.is_open())
+            {
+                return true;
+            }
+            journal_state state = {};
+            journal.read(reinterpret_cast<char*>(&state), sizeof(journal_state));
+            return journal.gcount() == sizeof(journal_state) && std::memcmp(state.magic, journal_magic, sizeof(journal_magic)) == 0 && state.active != 0;
+        }
+        // Completes an update interrupted while running from the journal next to the provided PBO.
+        //
+        // Returns true if no journal exists or it was completed.
+        static bool recover_journal(const std::filesystem::path& path)
+        {
+            auto jpath = journal_path(path);
+            std::error_code ec;
+            if (!std::filesystem::exists(jpath, ec))
+            {
+                return !ec;
+            }
+            {
+                std::fstream journal(jpath, std::ios_base::binary | std::ios_base::in | std::ios_base::out);
+                journal_state state = {};
+                journal.read(reinterpret_cast<char*>(&state), sizeof(journal_state));
+                if (journal.gcount() == sizeof(journal_state) && std::memcmp(state.magic, journal_magic, sizeof(journal_magic)) == 0 && state.active != 0)
+                {
+                    std::fstream file(path, std::ios_base::binary | std::ios_base::in | std::ios_base::out);
+                    std::vector<char> buffer;
+                    if (!file.is_open() || !run_journal(path, file, journal, state, buffer))
+                    {
+                        return false;
+                    }
+                }
+            }
+            std::filesystem::remove(jpath, ec);
+            return !ec && sync_directory(jpath);
+        }
+#if defined(__linux__)
+        // Appends length bytes at offset of the file in to the file out, copying inside of the kernel.
+        // Tries copy_file_range first, which may even share the blocks on file systems supporting it,
+        // then falls back to sendfile.
+        //
+        // Returns the amount of bytes copied, which is less than length if the kernel failed to copy the rest.
+        static size_t copy_in_kernel(int in, int out, std::streamoff offset, size_t length)
+        {
+            size_t copied = 0;
+            bool ranged = true;
+            while (copied < length)
+            {
+                ssize_t result;
+                if (ranged)
+                {
+                    loff_t in_offset = loff_t(offset) + loff_t(copied);
+                    result = ::copy_file_range(in, &in_offset, out, nullptr, length - copied, 0);
+                    if (result < 0 && (errno == ENOSYS || errno == EXDEV || errno == EOPNOTSUPP || errno == EINVAL))
+                    { // Not supported for these files
+                        ranged = false;
+                        continue;
+                    }
+                }
+                else
+                {
+                    off_t in_offset = off_t(offset) + off_t(copied);
+                    result = ::sendfile(out, in, &in_offset, length - copied);
+                }
+                if (result < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (result <= 0)
+                {
+                    break;
+                }
+                copied += size_t(result);
+            }
+            return copied;
+        }
+#endif
+        // Whether room reserved by create(path, options) is left for trim_reserve(), being
+        // a leading empty section holding data or any invalidated attribute.
+        //
+        // Remarks:
+        // - Worked out from the table, so a reserve survives closing and reopening the PBO.
+        //   Leading empty sections and invalidated attributes left behind by other edits count as well.
+        bool has_reserve() const
+        {
+            if (std::any_of(m_attributes.begin(), m_attributes.end() - 1, [](const attribute_& att) -> bool { return att.is_invalid(); }))
+            {
+                return true;
+            }
+            return m_headers.front().is_invalid() && m_headers.front().block_data.length() > 0;
+        }
+        // Removes what is left of the room reserved by create(path, options),
+        // being the leading empty sections and all invalidated attributes, moving the data to the front.
+        //
+        // Returns true on success.
+        //
+        // Remarks:
+        // - The data is moved through journaled_update, interrupting leaves a recoverable PBO behind.
+        // - Reopens the PBO.
+        bool trim_reserve()
+        {
+            auto first = m_headers.begin();
+            while (first != m_headers.end() - /* empty header */ 1 && first->is_invalid())
+            {
+                first++;
+            }
+            std::ostringstream table;
+            header version = {};
+            version.method = packing_method::version;
+            write_header(table, version, false);
+            for (auto it = m_attributes.begin(); it != m_attributes.end() - 1; ++it)
+            {
+                if (!it->is_invalid())
+                {
+                    write_attribute(table, *it, false);
+                }
+            }
+            table.write("\0", 1);
+            for (auto it = first; it != m_headers.end(); ++it)
+            {
+                write_header(table, *it, false);
+            }
+            auto rendered = table.str();
+            std::streamoff old_start = first->block_data.start;
+            std::streamoff new_start = std::streamoff(rendered.size());
+            std::streamoff length = data_end() - old_start;
+            if (old_start != new_start)
+            {
+                std::fstream file(m_path, std::ios_base::binary | std::ios_base::out | std::ios_base::in);
+                if (!file.is_open() || !file.good())
+                {
+                    return false;
+                }
+                std::vector<char> buffer(1024 * 1024);
+                if (!journaled_update(m_path, file, old_start, new_start, length, 0, rendered, new_start + length, buffer))
+                {
+                    return false;
+                }
+            }
+            open(m_path);
+            return good();
+        }
+    public:
+        pbofile() : m_lookup(lookup_mode::exact), m_good(false), m_growth(growth_method::none)
+        {
+        }
+        pbofile(std::filesystem::path p) : m_lookup(lookup_mode::exact), m_good(false), m_growth(growth_method::none)
+        {
+            if (std::filesystem::exists(p))
+            {
+                open(p);
+            }
+            else
+            {
+                create(p);
+            }
+        }
+        bool good() const { return m_good; }
+        // How data was moved the last time the table or attributes outgrew the room in front of the data.
+        growth_method last_growth() const { return m_growth; }
+        // How file names are matched by read(), write() and every other lookup by name.
+        lookup_mode lookup() const { return m_lookup; }
+        // Sets how file names are matched, see lookup_mode.
+        //
+        // Remarks:
+        // - In lookup_mode::normalized, names are normalized once when indexing the table,
+        //   looking up a name only normalizes the name looked up. No allocations are made for names up to 256 characters.
+        // - If multiple files normalize to the same name, the first one wins.
+        void lookup(lookup_mode mode)
+        {
+            if (m_lookup == mode)
+            {
+                return;
+            }
+            m_lookup = mode;
+            index_headers();
+        }
+
+        // Rearranges the files inside of the PBO in place, removing all empty sections and invalidated attributes.
+        //
+        // Returns true on success.
+        //
+        // Remarks:
+        // - Live data is slid down over dead data in a single forward pass. Data not preceded by
+        //   dead data is not moved at all.
+        // - After every move, only the two table entries affected get rewritten. The complete table
+        //   is rewritten once at the end, then the file gets truncated.
+        // - Each step leaves a valid PBO behind. Steps which cannot, as data moves over itself,
+        //   are journaled next to the file (see journaled_update) and completed by open() if interrupted.
+        //   Extra disk space needed stays constant.
+        // - Bytes freed in the table are kept as a single invalidated attribute, so no data moves for the table to shrink.
+        //   Later attribute() calls take it over.
+        // - Invalidates any open writers/readers and removes the trailer.
+        [[nodiscard]] bool defragment()
+        {
+            if (!strip_trailer())
+            {
+                return false;
+            }
+            std::fstream file(m_path, std::ios_base::binary | std::ios_base::out | std::ios_base::in);
+            if (!file.is_open() || !file.good())
+            {
+                return false;
+            }
+            // From here on, failing leaves the file valid, but the in-memory state outdated
+            auto fail = [this]() -> bool { m_good = false; return false; };
+            std::vector<char> buffer(1024 * 1024);
+            // Table entries are rendered up front and written at once, so they cannot get torn apart
+            auto render = [](std::initializer_list<const header*> entries) -> std::string
+            {
+                std::ostringstream out;
+                for (auto it : entries)
+                {
+                    write_header(out, *it, false);
+                }
+                return out.str();
+            };
+            // Entries are on disk once written, as the next step may overwrite what they pointed at before
+            auto write_entries = [this, &file](std::streamoff offset, const std::string& rendered) -> bool
+            {
+                file.seekp(offset);
+                file.write(rendered.data(), std::streamsize(rendered.size()));
+                return sync(file, m_path);
+            };
+
+            // Bubble all dead data to the end. Dead headers passed get merged into gap,
+            // whose name is grown so the table keeps its size.
+            std::vector<header> live;
+            live.reserve(m_headers.size());
+            std::optional<header> gap;
+            for (auto it = m_headers.begin(); it != m_headers.end() - 1; ++it)
+            {
+                if (it->is_invalid() && !gap.has_value())
+                {
+                    gap = *it;
+                    continue;
+                }
+                if (it->is_invalid())
+                {
+                    header merged = *gap;
+                    merged.name = m_names.intern(gap->bytes() + it->bytes() - sizeof(header::bin) - 1, '?');
+                    merged.size += it->size;
+                    merged.block_entry.end = it->block_entry.end;
+                    merged.block_data.end = it->block_data.end;
+                    if (!write_entries(merged.block_entry.start, render({ &merged })))
+                    {
+                        return fail();
+                    }
+                    gap = merged;
+                    continue;
+                }
+                if (!gap.has_value())
+                {
+                    live.push_back(*it);
+                    continue;
+                }
+                // Swap with the gap in front
+                header moved = *it;
+                moved.block_entry.start = gap->block_entry.start;
+                moved.block_entry.end = moved.block_entry.start + std::streamoff(moved.bytes());
+                moved.block_data.start = gap->block_data.start;
+                moved.block_data.end = moved.block_data.start + std::streamoff(moved.size);
+                header rest = *gap;
+                rest.block_entry.start = moved.block_entry.end;
+                rest.block_entry.end = it->block_entry.end;
+                rest.block_data.start = moved.block_data.end;
+                rest.block_data.end = it->block_data.end;
+                if (gap->size == 0 || gap->size >= moved.size)
+                { // Source stays intact until the entries are swapped
+                    if (!copy(file, it->block_data.start, it->block_data.start + std::streamoff(moved.size), moved.block_data.start))
+                    {
+                        return fail();
+                    }
+                    if (!sync(file, m_path) || !write_entries(moved.block_entry.start, render({ &moved, &rest })))
+                    {
+                        return fail();
+                    }
+                }
+                else if (!journaled_update(m_path, file, it->block_data.start, moved.block_data.start, moved.size, moved.block_entry.start, render({ &moved, &rest }), 0, buffer))
+                {
+                    return fail();
+                }
+                live.push_back(std::move(moved));
+                gap = std::move(rest);
+            }
+
+            // Render the final table, which has to take exactly as many bytes as the current one
+            std::vector<attribute_> attributes;
+            for (auto it = m_attributes.begin(); it != m_attributes.end() - 1; ++it)
+            {
+                if (!it->is_invalid())
+                {
+                    attributes.push_back(*it);
+                }
+            }
+            if (!gap.has_value() && attributes.size() == m_attributes.size() - 1)
+            { // Nothing to do, but names of entries changed before may still be released
+                compact_names();
+                return true;
+            }
+            std::streamoff table_size = m_headers.back().block_entry.end;
+            std::streamoff required = std::streamoff(sizeof(header::bin) + 1 + 1 + sizeof(header::bin) + 1);
+            for (auto& att : attributes)
+            {
+                required += std::streamoff(att.bytes());
+            }
+            for (auto& it : live)
+            {
+                required += std::streamoff(it.bytes());
+            }
+            // Freed bytes are at least 3, as that is the smallest possible attribute
+            auto freed = table_size - required;
+            if (freed > 0)
+            {
+                attributes.push_back({ m_names.intern(size_t(freed) - 2, '?'), {}, {} });
+            }
+            std::ostringstream table;
+            header version = {};
+            version.method = packing_method::version;
+            write_header(table, version, false);
+            for (auto& att : attributes)
+            {
+                write_attribute(table, att, false);
+            }
+            table.write("\0", 1);
+            for (auto& it : live)
+            {
+                write_header(table, it, false);
+            }
+            write_header(table, header{}, false);
+            auto rendered = table.str();
+            if (std::streamoff(rendered.size()) != table_size)
+            {
+                return fail();
+            }
+            auto end = live.empty() ? table_size : std::streamoff(live.back().block_data.end);
+            if (!journaled_update(m_path, file, 0, 0, 0, 0, rendered, end, buffer))
+            {
+                return fail();
+            }
+            file.close();
+            open(m_path);
+            return good();
+        }
+        // Gives the disk space taken by empty sections back to the file system, without moving any data.
+        // The amount of bytes the file takes less on disk is written to out_reclaimed.
+        //
+        // Returns true on success, false if not supported.
+        //
+        // Remarks:
+        // - Punches holes (FALLOC_FL_PUNCH_HOLE) into the block aligned interior of every run of empty sections.
+        //   Runs smaller than a block of the file system are left untouched.
+        // - The file size and all offsets stay the same, empty sections read as zeros afterwards.
+        // - Only available on Linux, for file systems supporting it (ext4, xfs, btrfs and tmpfs, mostly).
+        // - Removes the trailer if anything got punched, call seal() once done.
+        // - Releases names left behind by earlier changes (see compact_names), invalidating ranges handed out.
+        [[nodiscard]] bool reclaim(size_t& out_reclaimed)
+        {
+            out_reclaimed = 0;
+            if (!good())
+            {
+                return false;
+            }
+            compact_names();
+#if defined(__linux__)
+            collect_free_blocks();
+            int fd = ::open(m_path.c_str(), O_RDWR | O_CLOEXEC);
+            if (fd < 0)
+            {
+                return false;
+            }
+            struct stat st;
+            if (::fstat(fd, &st) != 0 || st.st_blksize <= 0)
+            {
+                ::close(fd);
+                return false;
+            }
+            auto blocks_before = st.st_blocks;
+            std::streamoff block = st.st_blksize;
+            bool stripped = false;
+            for (auto& it : m_free_blocks)
+            {
+                std::streamoff start = (std::streamoff(it.start) + block - 1) / block * block;
+                std::streamoff end = std::streamoff(it.end) / block * block;
+                if (end <= start)
+                {
+                    continue;
+                }
+                if (!stripped)
+                { // Zeroed data no longer matches the hash
+                    if (!strip_trailer())
+                    {
+                        ::close(fd);
+                        return false;
+                    }
+                    stripped = true;
+                }
+                if (::fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, start, end - start) != 0)
+                {
+                    ::close(fd);
+                    return false;
+                }
+            }
+            if (::fstat(fd, &st) == 0 && st.st_blocks < blocks_before)
+            { // st_blocks is in units of 512 bytes
+                out_reclaimed = size_t(blocks_before - st.st_blocks) * 512;
+            }
+            ::close(fd);
+            return true;
+#else
+            return false;
+#endif
+        }
+
+        // Opens the provided PBO file
+        //
+        // Remarks:
+        // - The attribute and header table is read in one go and parsed in memory.
+        //   Only if the table exceeds the initial read, further reads are issued.
+        // - Completes a defragment() which got interrupted first, unless journal is journal_mode::fail.
+        void open(const std::filesystem::path &path, journal_mode journal = journal_mode::recover)
+        {
+            m_good = false;
+            m_data_file.reset();
+            if (journal == journal_mode::recover ? !recover_journal(path) : journal_pending(path))
+            {
+                return;
+            }
+            std::ifstream file(path, std::ios_base::binary | std::ios_base::in);
+            if (!file.is_open() && !file.good())
+            {
+                return;
+            }
+            m_path = path;
+
+            std::vector<char> buffer;
+            size_t buffer_size = 64 * 1024;
+            size_t pos = 0;
+            table_result result = table_result::incomplete;
+            while (result == table_result::incomplete)
+            {
+                // Read the next chunk in, appending to what we already have
+                auto filled = buffer.size();
+                buffer.resize(buffer_size);
+                file.read(buffer.data() + filled, std::streamsize(buffer_size - filled));
+                buffer.resize(filled + size_t(file.gcount()));
+                result = read_table(std::string_view(buffer.data(), buffer.size()), pos);
+                if (result == table_result::incomplete && (file.eof() || !file.good()))
+                { // Table is truncated
+                    result = table_result::corrupted;
+                }
+                buffer_size *= 2;
+            }
+            if (result != table_result::done)
+            { // we failed :(
+                m_attributes.clear();
+                m_headers.clear();
+                return;
+            }
+            index_headers();
+            index_attributes();
+
+            auto offset = std::streampos(std::streamoff(pos));
+            // Add data-sections to headers
+            for (auto &it : m_headers)
+            {
+                it.block_data.start = offset;
+                offset += it.size;
+                it.block_data.end = offset;
+            }
+
+            m_data_file = std::make_shared<const positional_file>(path);
+            if (!m_data_file->good())
+            {
+                return;
+            }
+            // All fine here, end processing.
+            m_good = true;
+        }
+        // Creates a new, empty PBO file
+        void create(const std::filesystem::path& path)
+        {
+            create(path, reserve_options{});
+        }
+        // Creates a new, empty PBO file, reserving room in its table for the files and attributes expected.
+        //
+        // Remarks:
+        // - Room for attributes is reserved as a single invalidated attribute, room for files
+        //   as an empty section in front of all data. Both are taken over as files and attributes get added,
+        //   so no data has to be moved as long as the expectations hold.
+        // - Whatever is left of the reserved room is trimmed by the next seal().
+        void create(const std::filesystem::path& path, const reserve_options& options)
+        {
+            std::fstream file(path, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+            if (!file.is_open() && !file.good())
+            {
+                m_good = false;
+                return;
+            }
+            m_path = path;
+            sha1_streambuf hashing(file.rdbuf());
+            std::ostream out(&hashing);
+            header version = {};
+            version.method = packing_method::version;
+            write_header(out, version, false);
+
+            if (options.expected_attribute_bytes > 0)
+            { // One character of the name is always kept, see attributes_available()
+                attribute_ reserved = {};
+                reserved.key = m_names.intern(options.expected_attribute_bytes + 1, '?');
+                reserved.block.start = out.tellp();
+                write_attribute(out, reserved, false);
+                reserved.block.end = out.tellp();
+                m_attributes.push_back(reserved);
+            }
+            attribute_ attribute_empty = {};
+            attribute_empty.block.start = out.tellp();
+            out.write("\0", 1);
+            attribute_empty.block.end = out.tellp();
+
+            std::streamoff reserved_data = 0;
+            if (options.expected_entries > 0)
+            {
+                header reserved = {};
+                reserved.name = "?????";
+                reserved.method = packing_method::none;
+                reserved_data = std::streamoff(options.expected_entries * (options.expected_name_length + 1 + sizeof(header::bin)));
+                reserved.size = uint32_t(reserved_data);
+                reserved.block_entry.start = out.tellp();
+                write_header(out, reserved, false);
+                reserved.block_entry.end = out.tellp();
+                m_headers.push_back(reserved);
+            }
+            header header_empty = {};
+            header_empty.block_entry.start = out.tellp();
+            write_header(out, { }, false);
+            header_empty.block_data.start = header_empty.block_data.end = header_empty.block_entry.end = out.tellp();
+
+            if (reserved_data > 0)
+            {
+                std::vector<char> zeros(size_t(reserved_data), '\0');
+                out.write(zeros.data(), std::streamsize(zeros.size()));
+            }
+            write_trailer(file, hashing.digest());
+            file.flush();
+
+            m_attributes.push_back(attribute_empty);
+            m_headers.push_back(header_empty);
+            layout_data();
+
+            m_data_file = std::make_shared<const positional_file>(path);
+            m_good = out.good() && hashing.good() && file.good() && m_data_file->good();
+        }
+
+        // Creates a new reader for the provided header file.
+        //
+        // Remarks:
+        // - The reader is bound to the header as it is now. While a writer is active, flush it first
+        //   and create the reader afterwards to see its data, readers created earlier keep their old view.
+        [[nodiscard]] bool read(std::string_view filename, reader& out_reader) const
+        {
+            if (!good())
+            {
+                return false;
+            }
+            auto res = find_header(filename);
+            if (res == nullptr)
+            {
+                return false;
+            }
+            return out_reader.initialize(m_data_file, *res);
+        }
+        // Reads the whole contents of the provided file into a buffer owned by the caller.
+        //
+        // Returns true on success.
+        //
+        // Remarks:
+        // - Packed files are unpacked, out_size receives the size of the data read.
+        // - Fails without reading anything if buffer is too small.
+        [[nodiscard]] bool read_into(std::string_view filename, std::span<char> buffer, size_t& out_size) const
+        {
+            reader r;
+            if (!read(filename, r) || r.size() > buffer.size())
+            {
+                return false;
+            }
+            size_t done = 0;
+            while (done < r.size())
+            {
+                auto bytes = r.read(buffer.data() + done, std::streamsize(r.size() - done));
+                if (bytes == 0)
+                {
+                    return false;
+                }
+                done += bytes;
+            }
+            out_size = done;
+            return r.good();
+        }
+        // Receives the contents of a file read by read_many().
+        //
+        // Remarks:
+        // - data is only valid for the duration of the call.
+        using batch_sink = std::function<void(std::string_view name, std::span<const char> data)>;
+        // Reads the contents of multiple files, passing each to sink.
+        //
+        // Returns true if all files were found and read.
+        //
+        // Remarks:
+        // - Files are read in the order of their data, not in the order of names.
+        // - Files lying close to each other (see batch_read_options) are fetched in one read,
+        //   sink receives slices of that read.
+        // - Packed files are unpacked.
+        // - Files not in the PBO are skipped, all others are still read.
+        [[nodiscard]] bool read_many(std::span<const std::string_view> names, const batch_sink& sink, const batch_read_options& options = {}) const
+        {
+            if (!good() || m_data_file == nullptr)
+            {
+                return false;
+            }
+            bool success = true;
+            std::vector<std::pair<const header*, std::string_view>> requested;
+            requested.reserve(names.size());
+            for (auto& name : names)
+            {
+                auto res = find_header(name);
+                if (res == nullptr)
+                {
+                    success = false;
+                    continue;
+                }
+                requested.emplace_back(res, name);
+            }
+            std::stable_sort(requested.begin(), requested.end(), [](const auto& l, const auto& r) -> bool {
+                return l.first->block_data.start < r.first->block_data.start;
+            });
+
+            std::vector<char> buffer;
+            std::vector<char> unpacked;
+            auto group_start = requested.begin();
+            while (group_start != requested.end())
+            {
+                // Extend the group while the next file starts close enough behind what is covered already
+                auto first = std::streamoff(group_start->first->block_data.start);
+                auto last = std::streamoff(group_start->first->block_data.end);
+                auto group_end = group_start + 1;
+                for (; group_end != requested.end(); ++group_end)
+                {
+                    auto start = std::streamoff(group_end->first->block_data.start);
+                    auto end = std::streamoff(group_end->first->block_data.end);
+                    end = end > last ? end : last;
+                    if (start > last + std::streamoff(options.max_gap) || size_t(end - first) > options.max_read)
+                    {
+                        break;
+                    }
+                    last = end;
+                }
+
+                auto length = size_t(last - first);
+                if (buffer.size() < length)
+                {
+                    buffer.resize(length);
+                }
+                auto read = m_data_file->read_at(buffer.data(), length, uint64_t(first));
+                for (auto it = group_start; it != group_end; ++it)
+                {
+                    auto offset = size_t(std::streamoff(it->first->block_data.start) - first);
+                    auto size = it->first->block_data.length();
+                    if (offset + size > read)
+                    { // Data section exceeds the archive
+                        success = false;
+                        continue;
+                    }
+                    std::span<const char> data(buffer.data() + offset, size);
+                    if (it->first->is_packed())
+                    {
+                        size_t consumed = 0;
+                        lzss::decompressor unpacker(it->first->size_original, [&data, &consumed](char* arr, size_t bytes) -> size_t {
+                            auto remaining = data.size() - consumed;
+                            bytes = bytes < remaining ? bytes : remaining;
+                            std::memcpy(arr, data.data() + consumed, bytes);
+                            consumed += bytes;
+                            return bytes;
+                        });
+                        unpacked.resize(it->first->size_original);
+                        size_t done = 0;
+                        size_t bytes;
+                        while (done < unpacked.size() && (bytes = unpacker.read(unpacked.data() + done, unpacked.size() - done)) > 0)
+                        {
+                            done += bytes;
+                        }
+                        if (!unpacker.done())
+                        {
+                            success = false;
+                            continue;
+                        }
+                        data = std::span<const char>(unpacked.data(), done);
+                    }
+                    sink(it->second, data);
+                }
+                group_start = group_end;
+            }
+            return success;
+        }
+        // Creates a new writer, pointing at the end of this pbo for the provided file.
+        // Behavior is undefined for more then one active writer.
+        //
+        // For existing files, actual action happening is:
+        // 1. Copy old contents to the end.
+        // 2. Replace header offsets.
+        // 3. Create fake-header (header::empty_section) refering to the old contents.
+        // 4. Seek writer to start of current file.
+        //
+        // Remarks:
+        // - Removes the trailer, call seal() once all writers are done.
+        [[nodiscard]] bool write(std::string_view name, writer& out_writer)
+        {
+            if (!good() || !strip_trailer())
+            {
+                return false;
+            }
+            return out_writer.initialize(this, name);
+        }
+        // Creates a new writer for a file whose final size is known, or at least bounded, up front.
+        //
+        // The file is placed into the smallest run of empty sections able to hold size bytes,
+        // keeping the PBO from growing. If there is none, it is appended like write(name, writer) does.
+        //
+        // Remarks:
+        // - Previous contents of the file are discarded, its old data is free to be reused right away.
+        // - The writer may write more than size bytes. Once the file outgrows its empty sections,
+        //   it is moved to the end of the PBO.
+        // - Removes the trailer, call seal() once all writers are done.
+        [[nodiscard]] bool write(std::string_view name, writer& out_writer, size_t size)
+        {
+            if (!good() || !strip_trailer())
+            {
+                return false;
+            }
+            return out_writer.initialize(this, name, size);
+        }
+        // Creates a new writer for the provided file, treating existing data as mode says.
+        //
+        // With open_mode::overwrite, the writer starts at the beginning of the old data and
+        // writes straight into it, so only the bytes actually written cost I/O.
+        // Existing data is kept unless overwritten, use seek() to skip unchanged regions
+        // and truncate() to cut off the rest.
+        //
+        // Remarks:
+        // - Once the file outgrows its old data (and any empty section directly behind it),
+        //   it is moved to the end of the PBO, like open_mode::relocate does right away.
+        // - Removes the trailer, call seal() once all writers are done.
+        [[nodiscard]] bool write(std::string_view name, writer& out_writer, open_mode mode)
+        {
+            if (!good() || !strip_trailer())
+            {
+                return false;
+            }
+            return out_writer.initialize(this, name, mode);
+        }
+
+        // Starts a new transaction on this pbo, discarding anything staged in out_transaction before.
+        // See transaction for details.
+        [[nodiscard]] bool begin(transaction& out_transaction)
+        {
+            if (!good())
+            {
+                return false;
+            }
+            out_transaction.initialize(this);
+            return true;
+        }
+
+        // Returns all available attributes
+        //
+        // Remarks:
+        // - Creates a new vector of the current attributes and returns it.
+        std::vector<std::pair<std::string, std::string>> attributes() const
+        {
+            std::vector<std::pair<std::string, std::string>> pairs;
+            pairs.reserve(m_attributes.size());
+            for (auto it = m_attributes.begin(); it != m_attributes.end() - 1; ++it)
+            {
+                if (it->is_invalid())
+                {
+                    continue;
+                }
+                pairs.push_back(std::make_pair(std::string(it->key), std::string(it->value)));
+            }
+            return pairs;
+        }
+        // Looks up a single attribute and returns it, if it exists.
+        //
+        // Remarks:
+        // - If the attribute is not existing, empty optional will be returned
+        std::optional<std::string> attribute(std::string_view key) const
+        {
+            auto res = m_attribute_index.find(key);
+            if (res != m_attribute_index.end())
+            {
+                return std::string(m_attributes[res->second].value);
+            }
+            return {};
+        }
+        // Set a single attribute
+        //
+        // Remarks:
+        // - Always appends attribute
+        // - If attribute already exists, old attribute gets invalidated.
+        // - Can invalidates any open writers/readers
+        // - Removes the trailer, call seal() once done.
+        [[nodiscard]] bool attribute(std::string_view key, std::string_view value)
+        {
+            if (!strip_trailer())
+            {
+                return false;
+            }
+            std::fstream file(m_path, std::ios_base::binary | std::ios_base::out | std::ios_base::in);
+            if (!file.is_open() && !file.good())
+            {
+                m_good = false;
+                return false;
+            }
+
+            auto existing = m_attribute_index.find(key);
+            if (existing != m_attribute_index.end())
+            {
+                auto res = m_attributes.begin() + existing->second;
+                m_attribute_index.erase(existing);
+
+                // invalidate old attribute
+                res->key = m_names.intern(res->key.length(), '?');
+                res->value = m_names.intern(res->value.length(), '?');
+                write_attribute(file, *res);
+
                 // Create attribute
                 attribute_ att = {};
-                att.key = key;
-                att.value = value;
+                att.key = m_names.intern(key);
+                att.value = m_names.intern(value);
+                push_back(file, att);
+            }
+            else
+            {
+                attribute_ att = {};
+                att.key = m_names.intern(key);
+                att.value = m_names.intern(value);
                 push_back(file, att);
             }
-            else
+            return true;
+        }
+        // Iterates the available attributes as key and value pairs without copying them.
+        //
+        // Remarks:
+        // - See table_range for how long the range stays valid.
+        attribute_range attribute_view() const { return attribute_range(m_attributes); }
+        // Iterates the available files without copying their names.
+        //
+        // Remarks:
+        // - See table_range for how long the range stays valid.
+        entry_range entries() const { return entry_range(m_headers); }
+        // Collects a list of all available files
+        //
+        // Remarks:
+        // - Creates a new vector and returns it.
+        // - See entries() for iterating files without allocating.
+        std::vector<file_descriptor> files() const
+        {
+            std::vector<file_descriptor> descriptors;
+            descriptors.reserve(m_headers.size());
+            for (auto it = m_headers.begin(); it != m_headers.end() - 1; ++it)
+            {
+                if (it->is_invalid())
+                {
+                    continue;
+                }
+                file_descriptor descr = {};
+                descr.name = it->name;
+                descr.packing = it->method;
+                descr.size_original = it->size_original;
+                descr.size = it->size;
+                descriptors.push_back(descr);
+            }
+            return descriptors;
+        }
+
+        // Truncates this pbofile by recreating it in another file.
+        //
+        // Remarks:
+        // - Due to limitations with fstream, deleting from files is not possible.
+        //   Sadly this limitation requires copying to reduce filesizes.
+        // - The copy is sealed, its trailer is hashed while writing.
+        // - The data of neighbouring files is copied at once. On Linux, it is copied inside of the kernel
+        //   (see copy_in_kernel), elsewhere it is written straight from a memory mapping of this file.
+        bool copy_truncated(std::filesystem::path temporary) const
+        {
+            mapped_file original(m_path);
+            if (!original.good())
+            {
+                return false;
+            }
+            std::ostringstream table;
+            // Write version header
+            header version = {};
+            version.method = packing_method::version;
+            write_header(table, version, false);
+
+            for (auto& att : m_attributes)
+            {
+                if (att.is_invalid() || att.block.length() == 1) { continue; }
+                write_attribute(table, att, false);
+            }
+
+            // Write attribute termination
+            table.write("\0", 1);
+
+            for (auto& h : m_headers)
+            {
+                if (h.is_invalid() || h.name.empty()) { continue; }
+                write_header(table, h, false);
+            }
+
+            // Write header termination
+            write_header(table, { }, false);
+            auto rendered = table.str();
+
+            // Collect the data to copy, merging neighbouring files
+            std::vector<datablock> runs;
+            for (auto& h : m_headers)
+            {
+                if (h.is_invalid() || h.size == 0) { continue; }
+                if (!runs.empty() && runs.back().end == h.block_data.start)
+                {
+                    runs.back().end = h.block_data.end;
+                }
+                else
+                {
+                    runs.push_back(h.block_data);
+                }
+            }
+
+#if defined(__linux__)
+            int out = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+            if (out < 0)
+            {
+                return false;
+            }
+            auto append = [out](const void* data, size_t bytes) -> bool
+            {
+                auto in = static_cast<const char*>(data);
+                while (bytes > 0)
+                {
+                    auto written = ::write(out, in, bytes);
+                    if (written < 0 && errno == EINTR)
+                    {
+                        continue;
+                    }
+                    if (written <= 0)
+                    {
+                        return false;
+                    }
+                    in += written;
+                    bytes -= size_t(written);
+                }
+                return true;
+            };
+            auto append_run = [&](std::span<const std::byte> data, std::streamoff offset) -> bool
+            {
+                auto copied = copy_in_kernel(original.descriptor(), out, offset, data.size());
+                return append(data.data() + copied, data.size() - copied);
+            };
+#else
+            std::ofstream file(temporary, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+            if (!file.is_open() || !file.good())
+            {
+                return false;
+            }
+            auto append = [&file](const void* data, size_t bytes) -> bool
+            {
+                file.write(static_cast<const char*>(data), std::streamsize(bytes));
+                return file.good();
+            };
+            auto append_run = [&](std::span<const std::byte> data, std::streamoff) -> bool
+            {
+                return append(data.data(), data.size());
+            };
+#endif
+            sha1 hash;
+            hash.update(rendered.data(), rendered.size());
+            bool good = append(rendered.data(), rendered.size());
+            for (auto it = runs.begin(); good && it != runs.end(); ++it)
+            {
+                auto data = original.span(size_t(it->start), it->length());
+                good = data.size() == it->length();
+                if (good)
+                {
+                    hash.update(data.data(), data.size());
+                    good = append_run(data, it->start);
+                }
+            }
+            std::ostringstream trailer;
+            write_trailer(trailer, hash.digest());
+            auto trailer_rendered = trailer.str();
+            good = good && append(trailer_rendered.data(), trailer_rendered.size());
+#if defined(__linux__)
+            return ::close(out) == 0 && good;
+#else
+            file.flush();
+            return good && file.good();
+#endif
+        }
+        // Appends the trailer to the file, replacing any previous one.
+        // The trailer consists of a '\0' followed by the SHA-1 hash of all bytes before it.
+        //
+        // Returns true on success.
+        //
+        // Remarks:
+        // - All writers have to be closed before.
+        // - The file is read in one pass through a memory mapping.
+        // - Room reserved by create(path, options) but not taken over is trimmed first,
+        //   moving all data to the front once.
+        [[nodiscard]] bool seal()
+        {
+            if (!strip_trailer())
+            {
+                return false;
+            }
+            if (has_reserve() && !trim_reserve())
+            {
+                return false;
+            }
+            auto end = size_t(data_end());
+            sha1 hash;
+            {
+                mapped_file map(m_path);
+                auto data = map.span(0, end);
+                if (!map.good() || data.size() != end)
+                {
+                    return false;
+                }
+                hash.update(data.data(), data.size());
+            }
+            std::ofstream file(m_path, std::ios_base::binary | std::ios_base::out | std::ios_base::app);
+            if (!file.is_open() || !file.good())
+            {
+                return false;
+            }
+            write_trailer(file, hash.digest());
+            file.flush();
+            return file.good();
+        }
+        // Checks the trailer against the SHA-1 hash of the file contents.
+        //
+        // Returns true if the trailer exists and matches.
+        //
+        // Remarks:
+        // - Anything but the trailer following the last data block fails verification.
+        [[nodiscard]] bool verify() const
+        {
+            if (!good())
+            {
+                return false;
+            }
+            auto end = size_t(data_end());
+            mapped_file map(m_path);
+            auto data = map.span(0, end);
+            auto trailer = map.span(end, trailer_size);
+            if (!map.good() || map.size() != end + trailer_size || data.size() != end || trailer.size() != trailer_size || trailer[0] != std::byte{ 0 })
+            {
+                return false;
+            }
+            sha1 hash;
+            hash.update(data.data(), data.size());
+            auto digest = hash.digest();
+            return std::memcmp(digest.data(), trailer.data() + 1, digest.size()) == 0;
+        }
+
+        // Extracts all files into the provided directory, using a pool of worker threads.
+        // Backslashes in file names are turned into subdirectories.
+        //
+        // Returns true if all files were extracted.
+        //
+        // Remarks:
+        // - The archive is memory-mapped once, each file is written straight from the mapping.
+        // - Files whose name would escape the destination (eg. "..\file") are not extracted.
+        // - Packed files are unpacked.
+        // - Files mapping to the same output path, also when only differing in ASCII case or separators,
+        //   are extracted once. The first one wins, like it does on lookup.
+        [[nodiscard]] bool extract_all(const std::filesystem::path& destination, const extract_options& options, extract_statistics& out_statistics) const
+        {
+            auto started = std::chrono::steady_clock::now();
+            out_statistics = {};
+            if (!good())
+            {
+                return false;
+            }
+            mapped_file map(m_path);
+            if (!map.good())
+            {
+                return false;
+            }
+
+            // Collect targets and create the directory tree up front, so workers only have to write files
+            struct target
+            {
+                const header* source;
+                std::filesystem::path path;
+            };
+            bool success = true;
+            std::vector<target> targets;
+            std::set<std::filesystem::path> directories;
+            // Normalized relative paths already taken, keeping two workers from writing the same file
+            std::set<std::string> claimed;
+            targets.reserve(m_headers.size());
+            for (auto it = m_headers.begin(); it != m_headers.end() - 1; ++it)
+            {
+                if (it->is_invalid())
+                {
+                    continue;
+                }
+                auto relative = to_relative_path(it->name);
+                if (!relative.has_value())
+                {
+                    success = false;
+                    continue;
+                }
+                auto key = relative->generic_string();
+                path_key::normalize(key, key.data());
+                if (!claimed.insert(std::move(key)).second)
+                {
+                    out_statistics.duplicates++;
+                    continue;
+                }
+                auto path = destination / *relative;
+                directories.insert(path.parent_path());
+                targets.push_back({ &*it, std::move(path) });
+            }
+            for (auto& it : directories)
+            {
+                std::error_code ec;
+                std::filesystem::create_directories(it, ec);
+                if (ec)
+                {
+                    return false;
+                }
+            }
+
+            std::atomic<size_t> files = 0;
+            std::atomic<size_t> bytes = 0;
+            std::atomic<bool> failed = false;
+            {
+                thread_pool pool(options.threads);
+                for (auto& it : targets)
+                {
+                    pool.submit([&map, &it, &options, &files, &bytes, &failed]() {
+                        if (!options.overwrite && std::filesystem::exists(it.path))
+                        {
+                            return;
+                        }
+                        auto length = it.source->block_data.length();
+                        auto data = map.span(size_t(std::streamoff(it.source->block_data.start)), length);
+                        if (data.size() != length)
+                        { // Data section exceeds the archive
+                            failed = true;
+                            return;
+                        }
+                        std::ofstream file(it.path, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+                        if (!file.is_open() || !file.good())
+                        {
+                            failed = true;
+                            return;
+                        }
+                        if (it.source->is_packed())
+                        {
+                            size_t offset = 0;
+                            lzss::decompressor unpacker(it.source->size_original, [&data, &offset](char* arr, size_t bytes) -> size_t {
+                                auto remaining = data.size() - offset;
+                                bytes = bytes < remaining ? bytes : remaining;
+                                std::memcpy(arr, data.data() + offset, bytes);
+                                offset += bytes;
+                                return bytes;
+                            });
+                            std::vector<char> buffer(256 * 1024);
+                            size_t read;
+                            while ((read = unpacker.read(buffer.data(), buffer.size())) > 0)
+                            {
+                                file.write(buffer.data(), std::streamsize(read));
+                            }
+                            if (!unpacker.done())
+                            {
+                                failed = true;
+                                return;
+                            }
+                            length = it.source->size_original;
+                        }
+                        else
+                        {
+                            file.write(reinterpret_cast<const char*>(data.data()), std::streamsize(data.size()));
+                        }
+                        if (!file.good())
+                        {
+                            failed = true;
+                            return;
+                        }
+                        files++;
+                        bytes += length;
+                    });
+                }
+                pool.wait();
+            }
+
+            out_statistics.files = files;
+            out_statistics.bytes = bytes;
+            out_statistics.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+            return success && !failed;
+        }
+    };
+    // Verifies the trailers of multiple PBO files concurrently.
+    // If threads is 0, std::thread::hardware_concurrency() is used.
+    //
+    // Returns true if all files passed verification.
+    //
+    // Remarks:
+    // - out_results receives one result per path, in the same order.
+    // - Files that cannot be opened fail verification.
+    // - Files are only read. Files with an interrupted defragment() pending fail verification,
+    //   their journal is left for the next pbofile::open() to complete.
+    [[nodiscard]] inline bool verify_all(const std::vector<std::filesystem::path>& paths, size_t threads, std::vector<bool>& out_results)
+    {
+        std::vector<char> results(paths.size(), 0);
+        {
+            thread_pool pool(threads);
+            for (size_t i = 0; i < paths.size(); i++)
+            {
+                pool.submit([&paths, &results, i]() {
+                    pbofile pbo;
+                    pbo.open(paths[i], journal_mode::fail);
+                    results[i] = pbo.verify() ? 1 : 0;
+                });
+            }
+            pool.wait();
+        }
+        out_results.assign(results.begin(), results.end());
+        return std::all_of(results.begin(), results.end(), [](char result) -> bool { return result != 0; });
+    }
+    // Read-only, memory-mapped view of a PBO file.
+    //
+    // Remarks:
+    // - Headers are parsed using pbofile, the archive itself is mapped once.
+    // - Slices handed out are valid as long as the view is alive and open.
+    // - Modifying the underlying file while a view is open is undefined behavior.
+    class pbo_view
+    {
+        pbofile m_pbo;
+        mapped_file m_map;
+    public:
+        pbo_view() { }
+        pbo_view(const std::filesystem::path& path) { open(path); }
+        bool good() const { return m_pbo.good() && m_map.good(); }
+        // How file names are matched.
+        //
+        // Remarks:
+        // - See pbofile::lookup()
+        lookup_mode lookup() const { return m_pbo.lookup(); }
+        void lookup(lookup_mode mode) { m_pbo.lookup(mode); }
+
+        // Opens the provided PBO file for reading.
+        //
+        // Returns true on success.
+        bool open(const std::filesystem::path& path)
+        {
+            auto mode = m_pbo.lookup();
+            m_pbo = pbofile();
+            m_pbo.lookup(mode);
+            m_map.close();
+            if (!std::filesystem::exists(path))
+            {
+                return false;
+            }
+            m_pbo.open(path);
+            if (!m_pbo.good())
+            {
+                return false;
+            }
+            return m_map.open(path);
+        }
+
+        // Returns the data of the provided file.
+        //
+        // Returns true on success.
+        //
+        // Remarks:
+        // - No copy is made, out_data points into the mapping.
+        // - Data is returned as stored, packed files are not unpacked.
+        [[nodiscard]] bool read(std::string_view filename, std::span<const std::byte>& out_data) const
+        {
+            if (!good())
+            {
+                return false;
+            }
+            auto res = m_pbo.find_header(filename);
+            if (res == nullptr)
+            {
+                return false;
+            }
+            auto start = size_t(std::streamoff(res->block_data.start));
+            auto length = res->block_data.length();
+            out_data = m_map.span(start, length);
+            return out_data.size() == length;
+        }
+        // Returns the data of the provided file as text.
+        //
+        // Returns true on success.
+        //
+        // Remarks:
+        // - No copy is made, out_text points into the mapping.
+        [[nodiscard]] bool read(std::string_view filename, std::string_view& out_text) const
+        {
+            std::span<const std::byte> data;
+            if (!read(filename, data))
+            {
+                return false;
+            }
+            out_text = std::string_view(reinterpret_cast<const char*>(data.data()), data.size());
+            return true;
+        }
+
+        // Returns all available attributes
+        //
+        // Remarks:
+        // - See pbofile::attributes()
+        std::vector<std::pair<std::string, std::string>> attributes() const { return m_pbo.attributes(); }
+        // Looks up a single attribute and returns it, if it exists.
+        //
+        // Remarks:
+        // - See pbofile::attribute(std::string_view)
+        std::optional<std::string> attribute(std::string_view key) const { return m_pbo.attribute(key); }
+        // Collects a list of all available files
+        //
+        // Remarks:
+        // - See pbofile::files()
+        std::vector<file_descriptor> files() const { return m_pbo.files(); }
+        // Iterates the available attributes without copying them.
+        //
+        // Remarks:
+        // - See pbofile::attribute_view()
+        pbofile::attribute_range attribute_view() const { return m_pbo.attribute_view(); }
+        // Iterates the available files without copying their names.
+        //
+        // Remarks:
+        // - See pbofile::entries()
+        pbofile::entry_range entries() const { return m_pbo.entries(); }
+    };
+    // Reads ranges of many files of a PBO asynchronously.
+    //
+    // Remarks:
+    // - Backed by io_uring where available, by a thread pool otherwise (see uses_io_uring()).
+    // - Requests beyond the queue depth are held back and handed out as earlier ones complete.
+    // - Data is read as stored, packed files are not unpacked.
+    // - Buffers must stay alive until the completion of their request was reaped.
+    // - The pbofile must outlive the reader, its file table is consulted on submission.
+    //   Data a writer has not flushed yet is not seen (see pbofile::writer).
+    // - Requests must be submitted and reaped from one thread at a time.
+    class async_reader
+    {
+    public:
+        struct request
+        {
+            // Name of the file to read from
+            std::string_view name;
+            // Offset into the data of the file
+            uint64_t offset;
+            // Bytes to read, clamped to the data of the file
+            size_t length;
+            // Target of the read, must hold at least length bytes
+            void* buffer;
+            // Handed back with the completion
+            uint64_t user_data;
+        };
+        struct completion
+        {
+            uint64_t user_data;
+            // Bytes read into the buffer
+            size_t bytes;
+            // False if reading failed
+            bool good;
+        };
+    private:
+        // Largest read handed to the ring at once, bigger requests are split.
+        static constexpr size_t max_chunk = 1 << 30;
+        struct pending_read
+        {
+            uint64_t user_data;
+            char* buffer;
+            // Absolute offset in the PBO of the next byte to read
+            uint64_t position;
+            size_t remaining;
+            size_t done;
+        };
+
+        const pbofile* m_pbo;
+        std::shared_ptr<const positional_file> m_file;
+        unsigned m_queue_depth;
+        io_ring m_ring;
+        std::unique_ptr<thread_pool> m_pool;
+        // Reads of the ring, indexed by the user_data of their entries
+        std::vector<pending_read> m_slots;
+        std::vector<size_t> m_free_slots;
+        // Slots waiting for room in the ring
+        std::deque<size_t> m_queued;
+        // Slots handed to the ring
+        size_t m_in_flight;
+        // Requests submitted, but not yet reaped
+        size_t m_outstanding;
+        // Completions not yet reaped, filled by thread pool workers in fallback mode
+        std::deque<completion> m_ready;
+        std::mutex m_mutex;
+        std::condition_variable m_completed;
+
+        async_reader(const async_reader& copy) = delete;
+        async_reader& operator=(const async_reader& copy) = delete;
+
+#if defined(_WIN32)
+        int descriptor() const { return -1; }
+#else
+        int descriptor() const { return m_file->descriptor(); }
+#endif
+        // Moves queued reads into the ring while it has room.
+        void fill_ring()
+        {
+            while (!m_queued.empty())
+            {
+                auto slot = m_queued.front();
+                auto& read = m_slots[slot];
+                auto chunk = read.remaining < max_chunk ? read.remaining : max_chunk;
+                if (!m_ring.push_read(descriptor(), read.buffer + read.done, unsigned(chunk), read.position, uint64_t(slot)))
+                {
+                    return;
+                }
+                m_queued.pop_front();
+                m_in_flight++;
+            }
+        }
+        // Processes all completions available in the ring.
+        void drain_ring()
+        {
+            uint64_t slot;
+            int result;
+            while (m_ring.pop(slot, result))
+            {
+                m_in_flight--;
+                auto& read = m_slots[slot];
+                if (result > 0)
+                {
+                    read.done += size_t(result);
+                    read.position += uint64_t(result);
+                    read.remaining -= size_t(result);
+                    if (read.remaining > 0)
+                    { // Short or split read, continue with the rest
+                        m_queued.push_back(size_t(slot));
+                        continue;
+                    }
+                }
+                // result == 0 means the file ended before the header said so
+                m_ready.push_back({ read.user_data, read.done, read.remaining == 0 });
+                m_free_slots.push_back(size_t(slot));
+            }
+        }
+        void finish(const completion& done)
+        {
+            {
+                std::unique_lock lock(m_mutex);
+                m_ready.push_back(done);
+            }
+            m_completed.notify_one();
+        }
+    public:
+        async_reader() : m_pbo(nullptr), m_queue_depth(0), m_in_flight(0), m_outstanding(0) { }
+        // Creates a reader for the provided PBO.
+        //
+        // Remarks:
+        // - queue_depth is the amount of reads in flight at once.
+        // - If force_thread_pool is set, io_uring is not used even if available.
+        async_reader(const pbofile& pbo, unsigned queue_depth = 128, bool force_thread_pool = false) : async_reader() { open(pbo, queue_depth, force_thread_pool); }
+        // Waits for all reads in flight, as their buffers may not be released before.
+        ~async_reader() { close(); }
+
+        // Prepares reading from the provided PBO.
+        //
+        // Returns true on success.
+        bool open(const pbofile& pbo, unsigned queue_depth = 128, bool force_thread_pool = false)
+        {
+            close();
+            if (!pbo.good() || pbo.m_data_file == nullptr || !pbo.m_data_file->good())
+            {
+                return false;
+            }
+            m_pbo = &pbo;
+            m_file = pbo.m_data_file;
+            m_queue_depth = queue_depth == 0 ? 1 : queue_depth;
+            if (!force_thread_pool && descriptor() >= 0 && m_ring.open(m_queue_depth))
             {
-                attribute_ att = {};
-                att.key = key;
-                att.value = value;
-                push_back(file, att);
+                m_slots.clear();
+                m_free_slots.clear();
+                return true;
             }
+            m_pool = std::make_unique<thread_pool>(m_queue_depth < std::thread::hardware_concurrency() * 4 ? m_queue_depth : std::thread::hardware_concurrency() * 4);
             return true;
         }
-        // Collects a list of all available files
+        void close()
+        {
+            if (m_ring.good())
+            {
+                while (m_in_flight > 0)
+                {
+                    m_queued.clear();
+                    if (!m_ring.submit(1))
+                    {
+                        break;
+                    }
+                    drain_ring();
+                }
+            }
+            m_pool.reset();
+            m_ring.close();
+            m_file.reset();
+            m_pbo = nullptr;
+            m_slots.clear();
+            m_free_slots.clear();
+            m_queued.clear();
+            m_ready.clear();
+            m_in_flight = 0;
+            m_outstanding = 0;
+        }
+        bool good() const { return m_file != nullptr && (m_ring.good() || m_pool != nullptr); }
+        // Whether reads are performed by io_uring rather than the thread pool fallback.
+        bool uses_io_uring() const { return m_ring.good(); }
+        // Amount of requests submitted, but not yet reaped.
+        size_t outstanding() const { return m_outstanding; }
+
+        // Queues the provided requests and starts reading.
+        //
+        // Returns the amount of requests accepted, stopping at the first
+        // naming a file not in the PBO.
+        size_t submit(std::span<const request> requests)
+        {
+            if (!good())
+            {
+                return 0;
+            }
+            size_t accepted = 0;
+            for (auto& req : requests)
+            {
+                auto res = m_pbo->find_header(req.name);
+                if (res == nullptr)
+                {
+                    break;
+                }
+                auto length = uint64_t(res->block_data.length());
+                auto offset = req.offset < length ? req.offset : length;
+                auto bytes = length - offset < req.length ? size_t(length - offset) : req.length;
+                pending_read read = { req.user_data, static_cast<char*>(req.buffer), uint64_t(std::streamoff(res->block_data.start)) + offset, bytes, 0 };
+                accepted++;
+                m_outstanding++;
+                if (bytes == 0)
+                {
+                    finish({ req.user_data, 0, true });
+                }
+                else if (m_ring.good())
+                {
+                    size_t slot;
+                    if (m_free_slots.empty())
+                    {
+                        slot = m_slots.size();
+                        m_slots.push_back(read);
+                    }
+                    else
+                    {
+                        slot = m_free_slots.back();
+                        m_free_slots.pop_back();
+                        m_slots[slot] = read;
+                    }
+                    m_queued.push_back(slot);
+                }
+                else
+                {
+                    m_pool->submit([this, read]() {
+                        auto done = m_file->read_at(read.buffer, read.remaining, read.position);
+                        finish({ read.user_data, done, done == read.remaining });
+                    });
+                }
+            }
+            if (m_ring.good())
+            {
+                fill_ring();
+                m_ring.submit(0);
+            }
+            return accepted;
+        }
+        // Queues a single request and starts reading.
+        //
+        // Returns true if the file exists.
+        bool submit(const request& req) { return submit(std::span<const request>(&req, 1)) == 1; }
+
+        // Collects completions into out_completions, waiting until at least min_complete are available.
+        //
+        // Returns the amount of completions written.
         //
         // Remarks:
-        // - Creates a new vector and returns it.
-        std::vector<file_descriptor> files() const
+        // - min_complete is clamped to the size of out_completions and the amount of outstanding requests.
+        // - Pass 0 as min_complete to only collect what is already done.
+        size_t reap(std::span<completion> out_completions, size_t min_complete = 1)
         {
-            std::vector<file_descriptor> descriptors;
-            descriptors.reserve(m_headers.size());
-            for (auto it = m_headers.begin(); it != m_headers.end() - 1; ++it)
+            min_complete = min_complete < out_completions.size() ? min_complete : out_completions.size();
+            min_complete = min_complete < m_outstanding ? min_complete : m_outstanding;
+            if (m_ring.good())
             {
-                if (it->is_invalid())
+                drain_ring();
+                while (m_ready.size() < min_complete)
                 {
-                    continue;
+                    fill_ring();
+                    if (!m_ring.submit(1))
+                    {
+                        break;
+                    }
+                    drain_ring();
+                }
+                fill_ring();
+                if (!m_queued.empty() || m_in_flight > 0)
+                {
+                    m_ring.submit(0);
                 }
-                file_descriptor descr = {};
-                descr.name = it->name;
-                descr.packing = it->method;
-                descr.size = it->size_original;
-                descr.size = it->size;
-                descriptors.push_back(descr);
             }
-            return descriptors;
+            std::unique_lock lock(m_mutex);
+            if (m_pool != nullptr)
+            {
+                m_completed.wait(lock, [this, min_complete]() -> bool { return m_ready.size() >= min_complete; });
+            }
+            size_t count = 0;
+            while (count < out_completions.size() && !m_ready.empty())
+            {
+                out_completions[count++] = m_ready.front();
+                m_ready.pop_front();
+            }
+            m_outstanding -= count;
+            return count;
         }
+    };
+    // Builds a new PBO file from a list of sources in a single pass.
+    //
+    // Remarks:
+    // - Sizes of all sources must be known up front, so the header table
+    //   can be written before any data is streamed out sequentially.
+    // - Sources are only opened during build().
+    class pbo_builder
+    {
+    public:
+        // Reads up to `bytes` bytes into `arr`, returning the amount of bytes read.
+        // Returning 0 before the announced size was reached fails the build.
+        using producer = std::function<size_t(char* arr, size_t bytes)>;
+    private:
+        struct source
+        {
+            std::string name;
+            size_t size;
+            std::filesystem::path path;
+            producer callback;
+        };
+        std::vector<std::pair<std::string, std::string>> m_attributes;
+        std::vector<source> m_sources;
+        compression_options m_compression;
+        size_t m_buffer_size;
 
-        // Truncates this pbofile by recreating it in another file.
+        // Whether the provided source should be compressed according to m_compression
+        bool should_compress(const source& src) const
+        {
+            if (!m_compression.enabled || src.size == 0)
+            {
+                return false;
+            }
+            auto dot = src.name.find_last_of(".\\/");
+            if (dot == std::string::npos || src.name[dot] != '.')
+            {
+                return true;
+            }
+            auto extension = src.name.substr(dot);
+            std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) -> char { return char(std::tolower((unsigned char)c)); });
+            return std::find(m_compression.skip_extensions.begin(), m_compression.skip_extensions.end(), extension) == m_compression.skip_extensions.end();
+        }
+        // Reads the complete contents of the source into memory.
+        bool load_source(const source& src, std::vector<char>& out_data) const
+        {
+            out_data.resize(src.size);
+            if (src.callback)
+            {
+                size_t filled = 0;
+                while (filled < src.size)
+                {
+                    auto read = src.callback(out_data.data() + filled, src.size - filled);
+                    if (read == 0)
+                    {
+                        return false;
+                    }
+                    filled += read < src.size - filled ? read : src.size - filled;
+                }
+                return true;
+            }
+            std::ifstream input(src.path, std::ios_base::binary | std::ios_base::in);
+            if (!input.is_open() || !input.good())
+            {
+                return false;
+            }
+            input.read(out_data.data(), std::streamsize(src.size));
+            return size_t(input.gcount()) == src.size;
+        }
+
+        // Streams the contents of the source into file.
+        bool write_source(std::ostream& file, const source& src, std::vector<char>& buffer) const
+        {
+            std::ifstream input;
+            if (!src.callback)
+            {
+                input.open(src.path, std::ios_base::binary | std::ios_base::in);
+                if (!input.is_open() || !input.good())
+                {
+                    return false;
+                }
+            }
+            size_t remaining = src.size;
+            while (remaining > 0)
+            {
+                auto chunk = remaining < buffer.size() ? remaining : buffer.size();
+                size_t read;
+                if (src.callback)
+                {
+                    read = src.callback(buffer.data(), chunk);
+                    read = read < chunk ? read : chunk;
+                }
+                else
+                {
+                    input.read(buffer.data(), std::streamsize(chunk));
+                    read = size_t(input.gcount());
+                }
+                if (read == 0)
+                { // Source ended before its announced size
+                    return false;
+                }
+                file.write(buffer.data(), std::streamsize(read));
+                remaining -= read;
+            }
+            return file.good();
+        }
+    public:
+        pbo_builder() : m_buffer_size(1024 * 1024) { }
+
+        // Options controlling whether and how files are compressed.
+        const compression_options& compression() const { return m_compression; }
+        void compression(const compression_options& options) { m_compression = options; }
+
+        // Size of the buffer used to stream file data with.
+        size_t buffer_size() const { return m_buffer_size; }
+        void buffer_size(size_t bytes) { m_buffer_size = bytes == 0 ? 1 : bytes; }
+
+        // Sets a single attribute, replacing any previous value.
+        void attribute(std::string_view key, std::string_view value)
+        {
+            for (auto& it : m_attributes)
+            {
+                if (it.first == key)
+                {
+                    it.second = value;
+                    return;
+                }
+            }
+            m_attributes.emplace_back(key, value);
+        }
+        // Adds a file whose contents are read from disk.
+        //
+        // Returns true on success, false for names that cannot be stored (see pbofile::is_valid_file_name).
         //
         // Remarks:
-        // - Due to limitations with fstream, deleting from files is not possible.
-        //   Sadly this limitation requires copying to reduce filesizes.
-        bool copy_truncated(std::filesystem::path temporary) const
+        // - The size is taken now, the file must not change until build() is done.
+        [[nodiscard]] bool add(std::string_view name, const std::filesystem::path& path)
+        {
+            std::error_code ec;
+            auto size = std::filesystem::file_size(path, ec);
+            if (!pbofile::is_valid_file_name(name) || ec || size > std::numeric_limits<uint32_t>::max())
+            {
+                return false;
+            }
+            m_sources.push_back({ std::string(name), size_t(size), path, {} });
+            return true;
+        }
+        // Adds a file whose contents are provided by a callback.
+        //
+        // Returns true on success, false for names that cannot be stored (see pbofile::is_valid_file_name).
+        [[nodiscard]] bool add(std::string_view name, size_t size, producer callback)
+        {
+            if (!pbofile::is_valid_file_name(name) || !callback || size > std::numeric_limits<uint32_t>::max())
+            {
+                return false;
+            }
+            m_sources.push_back({ std::string(name), size, {}, std::move(callback) });
+            return true;
+        }
+        // Adds all regular files inside of directory, recursively.
+        // File names are the paths relative to directory, separated by '\'.
+        //
+        // Returns true on success.
+        [[nodiscard]] bool add_directory(const std::filesystem::path& directory)
         {
-            std::fstream copy(temporary, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
-            if (!copy.is_open() && !copy.good())
+            std::error_code ec;
+            std::vector<std::pair<std::string, std::filesystem::path>> found;
+            for (auto iter = std::filesystem::recursive_directory_iterator(directory, ec); !ec && iter != std::filesystem::recursive_directory_iterator(); iter.increment(ec))
+            {
+                if (!iter->is_regular_file())
+                {
+                    continue;
+                }
+                auto name = iter->path().lexically_relative(directory).generic_string();
+                std::replace(name.begin(), name.end(), '/', '\\');
+                found.emplace_back(std::move(name), iter->path());
+            }
+            if (ec)
             {
                 return false;
             }
-            std::fstream original(m_path, std::ios_base::binary | std::ios_base::out | std::ios_base::in);
-            if (!original.is_open() && !original.good())
+            // Keep output stable, independent of directory enumeration order
+            std::sort(found.begin(), found.end());
+            for (auto& [name, path] : found)
+            {
+                if (!add(name, path))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Writes the PBO to the provided path, replacing any existing file.
+        //
+        // Returns true on success.
+        //
+        // Remarks:
+        // - The header table is written exactly once, followed by all data in order.
+        // - The trailer hash is computed while writing, no second pass over the file is done.
+        // - With compression enabled, files to compress are loaded and compressed in parallel
+        //   before anything is written, holding their (compressed) contents in memory.
+        //   Producers of those files are called from worker threads.
+        [[nodiscard]] bool build(const std::filesystem::path& path) const
+        {
+            // Compress up front, as sizes have to be known before writing the header table
+            std::vector<std::vector<char>> loaded(m_sources.size());
+            std::vector<char> is_loaded(m_sources.size(), 0);
+            std::vector<char> is_packed(m_sources.size(), 0);
+            if (m_compression.enabled)
+            {
+                std::atomic<bool> failed = false;
+                thread_pool pool(m_compression.threads);
+                for (size_t i = 0; i < m_sources.size(); i++)
+                {
+                    if (!should_compress(m_sources[i]))
+                    {
+                        continue;
+                    }
+                    pool.submit([this, i, &loaded, &is_loaded, &is_packed, &failed]() {
+                        lzss::compressor packer(m_compression.max_chain);
+                        std::vector<char> raw;
+                        if (!load_source(m_sources[i], raw))
+                        {
+                            failed = true;
+                            return;
+                        }
+                        std::vector<char> packed;
+                        packer.compress(raw.data(), raw.size(), packed);
+                        bool keep_raw = packed.size() == raw.size()
+                            || packed.size() > std::numeric_limits<uint32_t>::max()
+                            || (m_compression.skip_incompressible && packed.size() > raw.size());
+                        loaded[i] = keep_raw ? std::move(raw) : std::move(packed);
+                        is_loaded[i] = 1;
+                        is_packed[i] = keep_raw ? 0 : 1;
+                    });
+                }
+                pool.wait();
+                if (failed)
+                {
+                    return false;
+                }
+            }
+
+            std::fstream output(path, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+            if (!output.is_open() || !output.good())
             {
                 return false;
             }
+            // Everything but the trailer is hashed while being written
+            sha1_streambuf hashing(output.rdbuf(), m_buffer_size);
+            std::ostream file(&hashing);
+
             // Write version header
-            header version = {};
+            pbofile::header version = {};
             version.method = packing_method::version;
-            write_header(copy, version, false);
+            pbofile::write_header(file, version, false);
 
-            for (auto& att : m_attributes)
+            // Write attributes and attribute termination
+            for (auto& [key, value] : m_attributes)
             {
-                if (att.is_invalid() || att.block.length() == 1) { continue; }
-                write_attribute(copy, att, false);
+                pbofile::attribute_ att = {};
+                att.key = key;
+                att.value = value;
+                pbofile::write_attribute(file, att, false);
             }
+            file.write("\0", 1);
 
-            // Write attribute termination
-            attribute_ attribute_empty = {};
-            attribute_empty.block.start = copy.tellp();
-            copy.write("\0", 1);
+            // Write headers and header termination
+            auto timestamp = (uint32_t)std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+            for (size_t i = 0; i < m_sources.size(); i++)
+            {
+                pbofile::header h = {};
+                h.name = m_sources[i].name;
+                h.method = is_packed[i] ? packing_method::compressed : packing_method::none;
+                h.size_original = is_packed[i] ? uint32_t(m_sources[i].size) : 0;
+                h.size = is_loaded[i] ? uint32_t(loaded[i].size()) : uint32_t(m_sources[i].size);
+                h.timestamp = timestamp;
+                pbofile::write_header(file, h, false);
+            }
+            pbofile::write_header(file, { }, false);
 
-            for (auto& h : m_headers)
+            // Stream out all data sequentially
+            std::vector<char> buffer(m_buffer_size);
+            for (size_t i = 0; i < m_sources.size(); i++)
+            {
+                if (is_loaded[i])
+                {
+                    file.write(loaded[i].data(), std::streamsize(loaded[i].size()));
+                    std::vector<char>().swap(loaded[i]);
+                }
+                else if (!write_source(file, m_sources[i], buffer))
+                {
+                    return false;
+                }
+            }
+            pbofile::write_trailer(output, hashing.digest());
+            output.flush();
+            return file.good() && hashing.good() && output.good();
+        }
+    };
+    // Resolves paths across many mounted PBO files, like the game does.
+    //
+    // Files are addressed by the prefix attribute of their PBO followed by their name,
+    // eg. "a3\functions_f\Actions\fn_APUOff.sqf".
+    //
+    // Remarks:
+    // - All files of all PBOs are kept in one hash index, so resolving a path does not depend on the amount of PBOs.
+    // - If multiple PBOs contain the same path, the one mounted with the highest priority wins.
+    //   On equal priority, the one mounted last wins. Within a single PBO, the first entry wins.
+    // - Paths are separated by backslashes, a leading backslash is ignored. They are matched
+    //   exactly or normalized, depending on the lookup_mode the vfs was created with.
+    // - Mounted PBOs are opened read-only and kept open until the vfs is cleared or destroyed.
+    class pbo_vfs
+    {
+    public:
+        // Contents of a directory, see list().
+        struct directory_listing
+        {
+            // Full paths of the files directly inside the directory
+            std::vector<std::string_view> files;
+            // Full paths of the directories directly inside the directory
+            std::vector<std::string_view> directories;
+        };
+    private:
+        struct path_hash
+        {
+            using is_transparent = void;
+            size_t operator()(std::string_view view) const { return path_key::hash(view); }
+        };
+        struct archive
+        {
+            std::unique_ptr<pbofile> pbo;
+            std::filesystem::path path;
+            std::string prefix;
+            int priority;
+        };
+        struct location
+        {
+            size_t archive;
+            // Name of the file inside of the archive, pointing into its table
+            std::string_view name;
+        };
+
+        std::vector<archive> m_archives;
+        lookup_mode m_lookup;
+        // Storage of the full paths referenced by m_index and m_directories
+        string_arena m_paths;
+        std::unordered_map<std::string_view, location, path_hash> m_index;
+        std::unordered_map<std::string_view, directory_listing, path_hash> m_directories;
+
+        static std::string_view trim(std::string_view path)
+        {
+            while (!path.empty() && path.front() == '\\') { path.remove_prefix(1); }
+            while (!path.empty() && path.back() == '\\') { path.remove_suffix(1); }
+            return path;
+        }
+        // Looks up the provided path in m_index, normalizing it first in lookup_mode::normalized.
+        std::unordered_map<std::string_view, location, path_hash>::const_iterator find(std::string_view path) const
+        {
+            if (m_lookup == lookup_mode::exact)
+            {
+                return m_index.find(trim(path));
+            }
+            path_key::buffer key(path);
+            return m_index.find(trim(key.view()));
+        }
+        // Adds the provided path to its parent directory, creating missing directories up to the root.
+        void add_to_directory(std::string_view path, bool is_directory)
+        {
+            auto separator = path.rfind('\\');
+            auto parent = separator == std::string_view::npos ? std::string_view() : path.substr(0, separator);
+            auto res = m_directories.find(parent);
+            bool created = res == m_directories.end();
+            if (created)
+            {
+                res = m_directories.emplace(parent, directory_listing{}).first;
+            }
+            (is_directory ? res->second.directories : res->second.files).push_back(path);
+            if (created && !parent.empty())
             {
-                if (h.is_invalid()) { continue; }
-                write_header(copy, h, false);
+                add_to_directory(parent, true);
             }
+        }
+    public:
+        // Creates an empty vfs.
+        //
+        // Remarks:
+        // - In lookup_mode::normalized, paths are indexed and listed normalized (see path_key::normalize).
+        pbo_vfs(lookup_mode mode = lookup_mode::exact) : m_lookup(mode) { }
+        pbo_vfs(const pbo_vfs& copy) = delete;
+        pbo_vfs& operator=(const pbo_vfs& copy) = delete;
 
-            // Write header termination
-            header header_empty = {};
-            header_empty.block_entry.start = attribute_empty.block.end = copy.tellp();
-            write_header(copy, { }, false);
-            header_empty.block_data.start = header_empty.block_data.end = header_empty.block_entry.end = copy.tellp();
+        // Opens the provided PBO file and adds its files to the index.
+        //
+        // Returns true on success.
+        //
+        // Remarks:
+        // - Files of PBOs mounted before with a higher priority are not overridden.
+        // - If the PBO holds the same path more than once, its first entry is used, as pbofile::read() would.
+        bool mount(const std::filesystem::path& path, int priority = 0)
+        {
+            auto pbo = std::make_unique<pbofile>();
+            pbo->lookup(m_lookup);
+            pbo->open(path);
+            if (!pbo->good())
+            {
+                return false;
+            }
+            auto prefix = pbo->attribute("prefix").value_or(std::string());
+            prefix = std::string(trim(prefix));
 
-            for (auto& h : m_headers)
+            auto index = m_archives.size();
+            std::string full;
+            for (auto entry : pbo->entries())
             {
-                if (h.is_invalid()) { continue; }
-                const size_t buffsize = 2048;
-                char buff[buffsize] = {};
-                auto pos = h.block_data.start;
-                original.seekg(h.block_data.start);
-                while (pos != h.block_data.end)
+                full.assign(prefix);
+                if (!full.empty())
+                {
+                    full.push_back('\\');
+                }
+                full.append(trim(entry.name));
+                if (m_lookup == lookup_mode::normalized)
                 {
-                    auto remaining = h.block_data.end - pos;
-                    remaining = remaining < buffsize ? remaining : buffsize;
-                    original.read(buff, remaining);
-                    copy.write(buff, remaining);
-                    pos += remaining;
+                    path_key::normalize(full, full.data());
+                }
+                auto res = m_index.find(std::string_view(full));
+                if (res == m_index.end())
+                {
+                    auto key = m_paths.intern(full);
+                    m_index.emplace(key, location{ index, entry.name });
+                    add_to_directory(key, false);
+                }
+                else if (res->second.archive != index && m_archives[res->second.archive].priority <= priority)
+                { // Within a PBO, the first entry wins like it does on pbofile lookups
+                    res->second = { index, entry.name };
                 }
             }
+            m_archives.push_back({ std::move(pbo), path, std::move(prefix), priority });
             return true;
         }
+        // Unmounts all PBOs.
+        void clear()
+        {
+            m_index.clear();
+            m_directories.clear();
+            m_paths.clear();
+            m_archives.clear();
+        }
+        // Amount of distinct files across all mounted PBOs.
+        size_t size() const { return m_index.size(); }
+        // Amount of mounted PBOs.
+        size_t archives() const { return m_archives.size(); }
+        lookup_mode lookup() const { return m_lookup; }
+
+        // Whether the provided path resolves to a file.
+        bool contains(std::string_view path) const { return find(path) != m_index.end(); }
+        // Returns the PBO the provided path resolves to, nullptr if none.
+        const std::filesystem::path* source(std::string_view path) const
+        {
+            auto res = find(path);
+            return res == m_index.end() ? nullptr : &m_archives[res->second.archive].path;
+        }
+        // Creates a new reader for the file the provided path resolves to.
+        //
+        // Returns true on success.
+        [[nodiscard]] bool read(std::string_view path, pbofile::reader& out_reader) const
+        {
+            auto res = find(path);
+            if (res == m_index.end())
+            {
+                return false;
+            }
+            return m_archives[res->second.archive].pbo->read(res->second.name, out_reader);
+        }
+        // Returns the contents of the provided directory, nullptr if it does not exist.
+        //
+        // Remarks:
+        // - Pass an empty path for the root directory.
+        // - Views point into the vfs and stay valid until it is cleared.
+        const directory_listing* list(std::string_view directory) const
+        {
+            auto res = m_directories.end();
+            if (m_lookup == lookup_mode::exact)
+            {
+                res = m_directories.find(trim(directory));
+            }
+            else
+            {
+                path_key::buffer key(directory);
+                res = m_directories.find(trim(key.view()));
+            }
+            return res == m_directories.end() ? nullptr : &res->second;
+        }
     };
 }
\ No newline at end of file
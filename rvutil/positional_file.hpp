@@ -0,0 +1,134 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <utility>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace rv::util
+{
+    // Read-only file handle reading at explicit offsets.
+    //
+    // Remarks:
+    // - Reads never move a shared file position, so any number of threads may read at once without locking.
+    // - Writers of the same file are not blocked.
+    class positional_file
+    {
+#if defined(_WIN32)
+        HANDLE m_file;
+#else
+        int m_fd;
+#endif
+
+        positional_file(const positional_file& copy) = delete;
+        positional_file& operator=(const positional_file& copy) = delete;
+    public:
+#if defined(_WIN32)
+        positional_file() : m_file(INVALID_HANDLE_VALUE) { }
+#else
+        positional_file() : m_fd(-1) { }
+#endif
+        positional_file(const std::filesystem::path& path) : positional_file() { open(path); }
+        positional_file(positional_file&& other) noexcept : positional_file() { swap(other); }
+        positional_file& operator=(positional_file&& other) noexcept
+        {
+            if (this != &other)
+            {
+                close();
+                swap(other);
+            }
+            return *this;
+        }
+        ~positional_file() { close(); }
+
+        void swap(positional_file& other) noexcept
+        {
+#if defined(_WIN32)
+            std::swap(m_file, other.m_file);
+#else
+            std::swap(m_fd, other.m_fd);
+#endif
+        }
+
+        // Opens the provided file for reading.
+        //
+        // Returns true on success.
+        bool open(const std::filesystem::path& path)
+        {
+            close();
+#if defined(_WIN32)
+            m_file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+#else
+            m_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+#endif
+            return good();
+        }
+        void close()
+        {
+#if defined(_WIN32)
+            if (m_file != INVALID_HANDLE_VALUE) { CloseHandle(m_file); }
+            m_file = INVALID_HANDLE_VALUE;
+#else
+            if (m_fd >= 0) { ::close(m_fd); }
+            m_fd = -1;
+#endif
+        }
+
+#if defined(_WIN32)
+        bool good() const { return m_file != INVALID_HANDLE_VALUE; }
+#else
+        bool good() const { return m_fd >= 0; }
+        // Descriptor of the file, -1 if not open.
+        int descriptor() const { return m_fd; }
+#endif
+
+        // Reads up to `bytes` bytes at offset into data, returning the amount of bytes read.
+        //
+        // Remarks:
+        // - Less than `bytes` bytes are only returned at the end of the file or on error.
+        size_t read_at(void* data, size_t bytes, uint64_t offset) const
+        {
+            auto out = static_cast<char*>(data);
+            size_t done = 0;
+            while (done < bytes && good())
+            {
+#if defined(_WIN32)
+                OVERLAPPED position = {};
+                position.Offset = DWORD(offset + done);
+                position.OffsetHigh = DWORD((offset + done) >> 32);
+                auto chunk = bytes - done < 0x40000000 ? DWORD(bytes - done) : DWORD(0x40000000);
+                DWORD read = 0;
+                if (!ReadFile(m_file, out + done, chunk, &read, &position) || read == 0)
+                {
+                    break;
+                }
+#else
+                auto read = ::pread(m_fd, out + done, bytes - done, off_t(offset + done));
+                if (read < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (read <= 0)
+                {
+                    break;
+                }
+#endif
+                done += size_t(read);
+            }
+            return done;
+        }
+    };
+}
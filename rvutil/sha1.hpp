@@ -0,0 +1,320 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <streambuf>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define RVUTIL_SHA1_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define RVUTIL_SHA1_TARGET
+#else
+#include <cpuid.h>
+#define RVUTIL_SHA1_TARGET __attribute__((target("sha,ssse3,sse4.1")))
+#endif
+#endif
+
+namespace rv::util
+{
+    // Incremental SHA-1 hash.
+    //
+    // Remarks:
+    // - Uses the SHA extensions of x86 processors if available.
+    class sha1
+    {
+    public:
+        using digest_type = std::array<uint8_t, 20>;
+    private:
+        uint32_t m_state[5];
+        uint8_t m_block[64];
+        size_t m_block_size;
+        uint64_t m_length;
+
+        static uint32_t rotl(uint32_t value, int bits) { return (value << bits) | (value >> (32 - bits)); }
+        static uint32_t load_be(const uint8_t* data)
+        {
+            return uint32_t(data[0]) << 24 | uint32_t(data[1]) << 16 | uint32_t(data[2]) << 8 | uint32_t(data[3]);
+        }
+
+        // Processes `blocks` 64 byte blocks in portable code.
+        static void process_generic(uint32_t state[5], const uint8_t* data, size_t blocks)
+        {
+            for (; blocks > 0; blocks--, data += 64)
+            {
+                uint32_t w[16];
+                for (int i = 0; i < 16; i++)
+                {
+                    w[i] = load_be(data + i * 4);
+                }
+                uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+                for (int i = 0; i < 80; i++)
+                {
+                    if (i >= 16)
+                    {
+                        w[i & 15] = rotl(w[(i + 13) & 15] ^ w[(i + 8) & 15] ^ w[(i + 2) & 15] ^ w[i & 15], 1);
+                    }
+                    uint32_t f, k;
+                    if (i < 20) { f = (b & c) | (~b & d); k = 0x5A827999; }
+                    else if (i < 40) { f = b ^ c ^ d; k = 0x6ED9EBA1; }
+                    else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+                    else { f = b ^ c ^ d; k = 0xCA62C1D6; }
+                    uint32_t temp = rotl(a, 5) + f + e + k + w[i & 15];
+                    e = d;
+                    d = c;
+                    c = rotl(b, 30);
+                    b = a;
+                    a = temp;
+                }
+                state[0] += a;
+                state[1] += b;
+                state[2] += c;
+                state[3] += d;
+                state[4] += e;
+            }
+        }
+#if defined(RVUTIL_SHA1_X86)
+        static bool has_sha_extensions()
+        {
+#if defined(_MSC_VER)
+            int info[4];
+            __cpuid(info, 0);
+            if (info[0] < 7) { return false; }
+            __cpuid(info, 1);
+            bool sse = (info[2] & (1 << 9)) && (info[2] & (1 << 19));
+            __cpuidex(info, 7, 0);
+            return sse && (info[1] & (1 << 29));
+#else
+            unsigned eax, ebx, ecx, edx;
+            if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) { return false; }
+            bool sse = (ecx & bit_SSSE3) && (ecx & bit_SSE4_1);
+            if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) { return false; }
+            return sse && (ebx & (1u << 29));
+#endif
+        }
+        // Four rounds of the SHA extension implementation.
+        // msg holds the message schedule, e the two alternating E values.
+        template<int group>
+        RVUTIL_SHA1_TARGET static inline void rounds_x86(__m128i& abcd, __m128i (&e)[2], __m128i (&msg)[4])
+        {
+            auto& current = e[group % 2];
+            auto& other = e[(group + 1) % 2];
+            if constexpr (group == 0)
+            {
+                current = _mm_add_epi32(current, msg[0]);
+            }
+            else
+            {
+                current = _mm_sha1nexte_epu32(current, msg[group % 4]);
+            }
+            other = abcd;
+            abcd = _mm_sha1rnds4_epu32(abcd, current, group / 5);
+            // Extend the message schedule for the upcoming groups
+            if constexpr (group >= 3 && group <= 18)
+            {
+                msg[(group + 1) % 4] = _mm_sha1msg2_epu32(msg[(group + 1) % 4], msg[group % 4]);
+            }
+            if constexpr (group >= 1 && group <= 16)
+            {
+                msg[(group + 3) % 4] = _mm_sha1msg1_epu32(msg[(group + 3) % 4], msg[group % 4]);
+            }
+            if constexpr (group >= 2 && group <= 17)
+            {
+                msg[(group + 2) % 4] = _mm_xor_si128(msg[(group + 2) % 4], msg[group % 4]);
+            }
+        }
+        template<int... groups>
+        RVUTIL_SHA1_TARGET static inline void all_rounds_x86(__m128i& abcd, __m128i (&e)[2], __m128i (&msg)[4], const uint8_t* data, std::integer_sequence<int, groups...>)
+        {
+            const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+            ((groups < 4
+                ? (void)(msg[groups % 4] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + groups * 16)), mask))
+                : (void)0,
+              rounds_x86<groups>(abcd, e, msg)), ...);
+        }
+        // Processes `blocks` 64 byte blocks using the SHA extensions.
+        RVUTIL_SHA1_TARGET static void process_x86(uint32_t state[5], const uint8_t* data, size_t blocks)
+        {
+            __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state)), 0x1B);
+            __m128i e0 = _mm_set_epi32(int(state[4]), 0, 0, 0);
+            for (; blocks > 0; blocks--, data += 64)
+            {
+                __m128i abcd_saved = abcd;
+                __m128i e_saved = e0;
+                __m128i e[2] = { e0, _mm_setzero_si128() };
+                __m128i msg[4];
+                all_rounds_x86(abcd, e, msg, data, std::make_integer_sequence<int, 20>());
+                e0 = _mm_sha1nexte_epu32(e[0], e_saved);
+                abcd = _mm_add_epi32(abcd, abcd_saved);
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(state), _mm_shuffle_epi32(abcd, 0x1B));
+            state[4] = uint32_t(_mm_extract_epi32(e0, 3));
+        }
+#endif
+        static void process(uint32_t state[5], const uint8_t* data, size_t blocks)
+        {
+#if defined(RVUTIL_SHA1_X86)
+            static const bool accelerated = has_sha_extensions();
+            if (accelerated)
+            {
+                process_x86(state, data, blocks);
+                return;
+            }
+#endif
+            process_generic(state, data, blocks);
+        }
+    public:
+        sha1() { reset(); }
+
+        void reset()
+        {
+            m_state[0] = 0x67452301;
+            m_state[1] = 0xEFCDAB89;
+            m_state[2] = 0x98BADCFE;
+            m_state[3] = 0x10325476;
+            m_state[4] = 0xC3D2E1F0;
+            m_block_size = 0;
+            m_length = 0;
+        }
+        // Appends the provided data to the hashed message.
+        void update(const void* data, size_t bytes)
+        {
+            auto in = static_cast<const uint8_t*>(data);
+            m_length += bytes;
+            if (m_block_size > 0)
+            {
+                auto fill = 64 - m_block_size < bytes ? 64 - m_block_size : bytes;
+                std::memcpy(m_block + m_block_size, in, fill);
+                m_block_size += fill;
+                in += fill;
+                bytes -= fill;
+                if (m_block_size < 64)
+                {
+                    return;
+                }
+                process(m_state, m_block, 1);
+                m_block_size = 0;
+            }
+            if (bytes >= 64)
+            {
+                process(m_state, in, bytes / 64);
+                in += bytes / 64 * 64;
+                bytes %= 64;
+            }
+            std::memcpy(m_block, in, bytes);
+            m_block_size = bytes;
+        }
+        // Returns the hash of all data passed so far.
+        // Further data may still be appended afterwards.
+        digest_type digest() const
+        {
+            sha1 copy = *this;
+            uint8_t padding[72] = { 0x80 };
+            auto padding_size = (m_block_size < 56 ? 56 : 120) - m_block_size;
+            uint64_t bits = m_length * 8;
+            for (int i = 0; i < 8; i++)
+            {
+                padding[padding_size + i] = uint8_t(bits >> (56 - i * 8));
+            }
+            copy.update(padding, padding_size + 8);
+            digest_type result;
+            for (int i = 0; i < 5; i++)
+            {
+                result[i * 4 + 0] = uint8_t(copy.m_state[i] >> 24);
+                result[i * 4 + 1] = uint8_t(copy.m_state[i] >> 16);
+                result[i * 4 + 2] = uint8_t(copy.m_state[i] >> 8);
+                result[i * 4 + 3] = uint8_t(copy.m_state[i]);
+            }
+            return result;
+        }
+    };
+
+    // Stream buffer hashing everything written before passing it on to another stream buffer.
+    //
+    // Remarks:
+    // - Only supports sequential output, tellp() reports the amount of bytes written.
+    class sha1_streambuf : public std::streambuf
+    {
+        std::streambuf* m_target;
+        sha1 m_hash;
+        std::vector<char> m_buffer;
+        std::streamoff m_written;
+        bool m_good;
+
+        bool flush_buffer()
+        {
+            auto pending = std::streamsize(pptr() - pbase());
+            if (pending > 0)
+            {
+                m_hash.update(pbase(), size_t(pending));
+                m_good = m_good && m_target->sputn(pbase(), pending) == pending;
+                m_written += pending;
+            }
+            setp(m_buffer.data(), m_buffer.data() + m_buffer.size());
+            return m_good;
+        }
+    protected:
+        int_type overflow(int_type ch) override
+        {
+            if (!flush_buffer())
+            {
+                return traits_type::eof();
+            }
+            if (!traits_type::eq_int_type(ch, traits_type::eof()))
+            {
+                *pptr() = traits_type::to_char_type(ch);
+                pbump(1);
+            }
+            return traits_type::not_eof(ch);
+        }
+        std::streamsize xsputn(const char* s, std::streamsize count) override
+        {
+            if (count < epptr() - pptr())
+            {
+                std::memcpy(pptr(), s, size_t(count));
+                pbump(int(count));
+                return count;
+            }
+            // Large writes bypass the buffer
+            if (!flush_buffer())
+            {
+                return 0;
+            }
+            m_hash.update(s, size_t(count));
+            auto written = m_target->sputn(s, count);
+            m_good = m_good && written == count;
+            m_written += written;
+            return written;
+        }
+        int sync() override
+        {
+            return flush_buffer() && m_target->pubsync() == 0 ? 0 : -1;
+        }
+        pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override
+        {
+            if (off != 0 || dir != std::ios_base::cur || !(which & std::ios_base::out))
+            {
+                return pos_type(off_type(-1));
+            }
+            return pos_type(m_written + (pptr() - pbase()));
+        }
+    public:
+        sha1_streambuf(std::streambuf* target, size_t buffer_size = 64 * 1024) : m_target(target), m_buffer(buffer_size == 0 ? 1 : buffer_size), m_written(0), m_good(target != nullptr)
+        {
+            setp(m_buffer.data(), m_buffer.data() + m_buffer.size());
+        }
+        ~sha1_streambuf() { flush_buffer(); }
+
+        // Passes on all buffered data and returns the hash of everything written so far.
+        sha1::digest_type digest()
+        {
+            flush_buffer();
+            return m_hash.digest();
+        }
+        // False if passing data on to the target failed.
+        bool good() const { return m_good; }
+    };
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace rv::util
+{
+    // Append-only storage packing many small strings into a few large chunks.
+    //
+    // Remarks:
+    // - Views handed out stay valid until clear() is called or the arena is destroyed.
+    //   Moving the arena keeps them valid, as chunks are never reallocated.
+    // - Strings are neither deduplicated nor freed individually.
+    class string_arena
+    {
+        std::vector<std::unique_ptr<char[]>> m_chunks;
+        size_t m_chunk_size;
+        // Bytes used and available in the last chunk
+        size_t m_used;
+        size_t m_capacity;
+        // Bytes handed out across all chunks
+        size_t m_size;
+
+        string_arena(const string_arena& copy) = delete;
+        string_arena& operator=(const string_arena& copy) = delete;
+
+        char* allocate(size_t bytes)
+        {
+            if (bytes > m_capacity - m_used)
+            { // Oversized strings get a chunk of their own
+                auto capacity = std::max(bytes, m_chunk_size);
+                m_chunks.push_back(std::make_unique_for_overwrite<char[]>(capacity));
+                m_used = 0;
+                m_capacity = capacity;
+            }
+            auto data = m_chunks.back().get() + m_used;
+            m_used += bytes;
+            m_size += bytes;
+            return data;
+        }
+    public:
+        string_arena(size_t chunk_size = 64 * 1024) : m_chunk_size(chunk_size == 0 ? 1 : chunk_size), m_used(0), m_capacity(0), m_size(0) { }
+        string_arena(string_arena&& other) noexcept : string_arena(other.m_chunk_size) { *this = std::move(other); }
+        string_arena& operator=(string_arena&& other) noexcept
+        {
+            if (this != &other)
+            {
+                m_chunks = std::move(other.m_chunks);
+                m_chunk_size = other.m_chunk_size;
+                m_used = std::exchange(other.m_used, 0);
+                m_capacity = std::exchange(other.m_capacity, 0);
+                m_size = std::exchange(other.m_size, 0);
+                other.m_chunks.clear();
+            }
+            return *this;
+        }
+
+        // Copies the provided string into the arena, returning a view of the copy.
+        std::string_view intern(std::string_view str)
+        {
+            if (str.empty())
+            {
+                return {};
+            }
+            auto data = allocate(str.length());
+            std::memcpy(data, str.data(), str.length());
+            return { data, str.length() };
+        }
+        // Stores a string of length times c, returning a view of it.
+        std::string_view intern(size_t length, char c)
+        {
+            if (length == 0)
+            {
+                return {};
+            }
+            auto data = allocate(length);
+            std::memset(data, c, length);
+            return { data, length };
+        }
+        // Releases all strings, invalidating every view handed out.
+        void clear()
+        {
+            m_chunks.clear();
+            m_used = 0;
+            m_capacity = 0;
+            m_size = 0;
+        }
+        // Bytes taken by all strings stored.
+        size_t size() const { return m_size; }
+    };
+}
@@ -0,0 +1,102 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace rv::util
+{
+    // Fixed-size pool of worker threads processing submitted tasks in FIFO order.
+    //
+    // Remarks:
+    // - Tasks must not throw.
+    // - Destroying the pool waits for all submitted tasks to complete.
+    class thread_pool
+    {
+        std::vector<std::thread> m_threads;
+        std::deque<std::function<void()>> m_tasks;
+        std::mutex m_mutex;
+        std::condition_variable m_task_available;
+        std::condition_variable m_idle;
+        size_t m_active;
+        bool m_stop;
+
+        thread_pool(const thread_pool& copy) = delete;
+        thread_pool& operator=(const thread_pool& copy) = delete;
+
+        void work()
+        {
+            while (true)
+            {
+                std::function<void()> task;
+                {
+                    std::unique_lock lock(m_mutex);
+                    m_task_available.wait(lock, [this]() -> bool { return m_stop || !m_tasks.empty(); });
+                    if (m_tasks.empty())
+                    { // m_stop is set and nothing is left to do
+                        return;
+                    }
+                    task = std::move(m_tasks.front());
+                    m_tasks.pop_front();
+                    m_active++;
+                }
+                task();
+                {
+                    std::unique_lock lock(m_mutex);
+                    m_active--;
+                    if (m_active == 0 && m_tasks.empty())
+                    {
+                        m_idle.notify_all();
+                    }
+                }
+            }
+        }
+    public:
+        // Creates a new pool with the provided amount of threads.
+        // If threads is 0, std::thread::hardware_concurrency() is used.
+        thread_pool(size_t threads = 0) : m_active(0), m_stop(false)
+        {
+            if (threads == 0)
+            {
+                threads = std::thread::hardware_concurrency();
+                threads = threads == 0 ? 1 : threads;
+            }
+            m_threads.reserve(threads);
+            for (size_t i = 0; i < threads; i++)
+            {
+                m_threads.emplace_back([this]() { work(); });
+            }
+        }
+        ~thread_pool()
+        {
+            {
+                std::unique_lock lock(m_mutex);
+                m_stop = true;
+            }
+            m_task_available.notify_all();
+            for (auto& it : m_threads)
+            {
+                it.join();
+            }
+        }
+        size_t size() const { return m_threads.size(); }
+
+        // Queues the provided task for execution on one of the workers.
+        void submit(std::function<void()> task)
+        {
+            {
+                std::unique_lock lock(m_mutex);
+                m_tasks.push_back(std::move(task));
+            }
+            m_task_available.notify_one();
+        }
+        // Blocks until all submitted tasks have been processed.
+        void wait()
+        {
+            std::unique_lock lock(m_mutex);
+            m_idle.wait(lock, [this]() -> bool { return m_active == 0 && m_tasks.empty(); });
+        }
+    };
+}
@@ -0,0 +1,316 @@
+// Replays journals left behind by an interrupted pbofile::defragment() at each of its stages,
+// checking that open() completes them into the expected PBO.
+#include "pbo.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+    using bytes = std::vector<char>;
+
+    // Mirrors the on-disk layout of pbofile::journal_state
+    struct journal_state
+    {
+        char magic[4];
+        uint32_t active;
+        uint64_t old_start;
+        uint64_t new_start;
+        uint64_t length;
+        uint64_t next;
+        uint64_t chunk_size;
+        uint64_t slot;
+        uint64_t table_offset;
+        uint64_t table_length;
+        uint64_t truncate_to;
+    };
+    constexpr uint64_t no_slot = UINT64_MAX;
+    constexpr uint64_t chunk_size = 64 * 1024;
+
+    std::filesystem::path directory()
+    {
+        auto path = std::filesystem::temp_directory_path() / "rvutil-journal-tests";
+        std::filesystem::create_directories(path);
+        return path;
+    }
+    bytes read_file(const std::filesystem::path& path)
+    {
+        std::ifstream file(path, std::ios_base::binary);
+        return bytes(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    void write_file(const std::filesystem::path& path, const bytes& data)
+    {
+        std::ofstream file(path, std::ios_base::binary | std::ios_base::trunc);
+        file.write(data.data(), std::streamsize(data.size()));
+    }
+    std::filesystem::path journal_path(const std::filesystem::path& path)
+    {
+        auto copy = path;
+        copy += ".defrag";
+        return copy;
+    }
+
+    // The PBO a completed update has to produce, split into its table and everything behind it.
+    struct expected
+    {
+        bytes file;
+        size_t table_length;
+
+        bytes table() const { return bytes(file.begin(), file.begin() + std::streamoff(table_length)); }
+        bytes data() const { return bytes(file.begin() + std::streamoff(table_length), file.end()); }
+    };
+    expected build_expected()
+    {
+        std::mt19937 random(42);
+        std::vector<bytes> contents;
+        rv::util::pbo::pbo_builder builder;
+        builder.attribute("prefix", "tests\\journal");
+        size_t total = 0;
+        for (auto size : { size_t(150000), size_t(70000), size_t(1234), size_t(100000) })
+        {
+            bytes content(size);
+            for (auto& c : content)
+            {
+                c = char(random());
+            }
+            contents.push_back(std::move(content));
+            total += size;
+        }
+        for (size_t i = 0; i < contents.size(); i++)
+        {
+            auto& content = contents[i];
+            auto produced = std::make_shared<size_t>(0);
+            if (!builder.add("file" + std::to_string(i) + ".bin", content.size(), [&content, produced](char* arr, size_t count) -> size_t {
+                count = std::min(count, content.size() - *produced);
+                std::memcpy(arr, content.data() + *produced, count);
+                *produced += count;
+                return count;
+            }))
+            {
+                return {};
+            }
+        }
+        auto path = directory() / "expected.pbo";
+        if (!builder.build(path))
+        {
+            return {};
+        }
+        expected result;
+        result.file = read_file(path);
+        // Data is followed by the trailer, '\0' and the SHA-1 hash
+        result.table_length = result.file.size() - total - 21;
+        return result;
+    }
+
+    // Writes the journal for moving the data of e down by gap bytes, followed by writing its table.
+    void write_journal(const std::filesystem::path& path, const expected& e, size_t gap, uint32_t active, uint64_t next, uint64_t slot, const bytes& slot0, const bytes& slot1)
+    {
+        auto data = e.data();
+        journal_state state = {};
+        std::memcpy(state.magic, "rvj1", 4);
+        state.active = active;
+        state.old_start = e.table_length + gap;
+        state.new_start = e.table_length;
+        state.length = data.size();
+        state.next = next;
+        state.chunk_size = chunk_size;
+        state.slot = slot;
+        state.table_offset = 0;
+        state.table_length = e.table_length;
+        state.truncate_to = e.file.size();
+
+        bytes journal(sizeof(state));
+        std::memcpy(journal.data(), &state, sizeof(state));
+        auto table = e.table();
+        journal.insert(journal.end(), table.begin(), table.end());
+        for (auto* it : { &slot0, &slot1 })
+        {
+            auto padded = *it;
+            padded.resize(chunk_size, '\0');
+            journal.insert(journal.end(), padded.begin(), padded.end());
+        }
+        write_file(journal_path(path), journal);
+    }
+    // Layout before the update: a stale table, gap bytes of dead data and the data to move down.
+    bytes initial_layout(const expected& e, size_t gap)
+    {
+        bytes file(e.table_length, 'T');
+        file.insert(file.end(), gap, 'G');
+        auto data = e.data();
+        file.insert(file.end(), data.begin(), data.end());
+        return file;
+    }
+    // Moves the first chunks of data down in file, as run_journal does.
+    void move_chunks(bytes& file, const expected& e, size_t gap, size_t chunks)
+    {
+        auto length = e.file.size() - e.table_length;
+        for (size_t i = 0; i < chunks; i++)
+        {
+            auto offset = i * chunk_size;
+            auto count = std::min<size_t>(chunk_size, length - offset);
+            std::memmove(file.data() + e.table_length + offset, file.data() + e.table_length + gap + offset, count);
+        }
+    }
+    bytes chunk_of(const expected& e, size_t index)
+    {
+        auto data = e.data();
+        auto offset = index * chunk_size;
+        auto count = std::min<size_t>(chunk_size, data.size() - offset);
+        return bytes(data.begin() + std::streamoff(offset), data.begin() + std::streamoff(offset + count));
+    }
+
+    // Opens the PBO at path, which has to replay its journal into e.
+    bool recovers_into(const std::filesystem::path& path, const expected& e)
+    {
+        rv::util::pbo::pbofile pbo;
+        pbo.open(path);
+        if (!pbo.good())
+        {
+            std::cerr << "    open() failed" << std::endl;
+            return false;
+        }
+        if (std::filesystem::exists(journal_path(path)))
+        {
+            std::cerr << "    journal was not removed" << std::endl;
+            return false;
+        }
+        if (read_file(path) != e.file)
+        {
+            std::cerr << "    contents differ from the expected PBO" << std::endl;
+            return false;
+        }
+        return pbo.verify() && pbo.files().size() == 4;
+    }
+
+    // Interrupted right after activating the journal, nothing was moved yet.
+    bool replays_from_start(const expected& e)
+    {
+        auto path = directory() / "from-start.pbo";
+        size_t gap = 100;
+        write_file(path, initial_layout(e, gap));
+        write_journal(path, e, gap, 1, 0, no_slot, {}, {});
+        return recovers_into(path, e);
+    }
+    // Chunks overlap their source. Interrupted while writing the third chunk,
+    // its source is overwritten already and only its copy in the journal is intact.
+    bool replays_interrupted_overlapping_chunk(const expected& e)
+    {
+        auto path = directory() / "overlapping-chunk.pbo";
+        size_t gap = 100;
+        auto file = initial_layout(e, gap);
+        move_chunks(file, e, gap, 2);
+        auto chunk = chunk_of(e, 2);
+        std::memcpy(file.data() + e.table_length + 2 * chunk_size, chunk.data(), chunk.size() / 2);
+        write_file(path, file);
+        write_journal(path, e, gap, 1, 2 * chunk_size, 0, chunk, chunk_of(e, 1));
+        return recovers_into(path, e);
+    }
+    // Chunks do not overlap their source and are not copied. Interrupted while writing the second chunk.
+    bool replays_interrupted_chunk(const expected& e)
+    {
+        auto path = directory() / "chunk.pbo";
+        size_t gap = chunk_size + 100;
+        auto file = initial_layout(e, gap);
+        move_chunks(file, e, gap, 1);
+        auto chunk = chunk_of(e, 1);
+        std::memcpy(file.data() + e.table_length + chunk_size, chunk.data(), chunk.size() / 2);
+        write_file(path, file);
+        write_journal(path, e, gap, 1, chunk_size, no_slot, {}, {});
+        return recovers_into(path, e);
+    }
+    // All data was moved, interrupted while writing the table and before truncating.
+    bool replays_interrupted_table_write(const expected& e)
+    {
+        auto path = directory() / "table-write.pbo";
+        size_t gap = 100;
+        auto file = initial_layout(e, gap);
+        move_chunks(file, e, gap, (e.file.size() - e.table_length + chunk_size - 1) / chunk_size);
+        auto table = e.table();
+        std::memcpy(file.data(), table.data(), table.size() / 2);
+        write_file(path, file);
+        write_journal(path, e, gap, 1, e.file.size() - e.table_length, 1, {}, chunk_of(e, 4));
+        return recovers_into(path, e);
+    }
+    // Verifying only reads. A pending journal fails verification and is left for open() to complete.
+    bool verify_leaves_pending_journal(const expected& e)
+    {
+        auto path = directory() / "verify.pbo";
+        size_t gap = 100;
+        auto file = initial_layout(e, gap);
+        write_file(path, file);
+        write_journal(path, e, gap, 1, 0, no_slot, {}, {});
+        auto journal = read_file(journal_path(path));
+        std::vector<bool> results;
+        if (rv::util::pbo::verify_all({ path }, 1, results) || results.size() != 1 || results[0])
+        {
+            std::cerr << "    verification passed" << std::endl;
+            return false;
+        }
+        if (read_file(path) != file || read_file(journal_path(path)) != journal)
+        {
+            std::cerr << "    verification changed the PBO or its journal" << std::endl;
+            return false;
+        }
+        return recovers_into(path, e);
+    }
+    // Interrupted while writing the journal itself, before activating it. The PBO was not touched.
+    bool discards_inactive_journal(const expected& e)
+    {
+        auto path = directory() / "inactive.pbo";
+        write_file(path, e.file);
+        write_journal(path, e, 100, 0, 0, no_slot, {}, {});
+        // Cut off, as if the journal was written only partially
+        auto journal = read_file(journal_path(path));
+        journal.resize(sizeof(journal_state) + 10);
+        write_file(journal_path(path), journal);
+        return recovers_into(path, e);
+    }
+    // A journal too short to hold its state is discarded as well.
+    bool discards_truncated_journal(const expected& e)
+    {
+        auto path = directory() / "truncated.pbo";
+        write_file(path, e.file);
+        write_file(journal_path(path), bytes(5, 'r'));
+        return recovers_into(path, e);
+    }
+}
+
+int main()
+{
+    auto e = build_expected();
+    if (e.file.empty())
+    {
+        std::cerr << "Failed to build the expected PBO" << std::endl;
+        return 1;
+    }
+    struct test
+    {
+        const char* name;
+        bool (*run)(const expected&);
+    };
+    const test tests[] = {
+        { "replays_from_start", replays_from_start },
+        { "replays_interrupted_overlapping_chunk", replays_interrupted_overlapping_chunk },
+        { "replays_interrupted_chunk", replays_interrupted_chunk },
+        { "replays_interrupted_table_write", replays_interrupted_table_write },
+        { "verify_leaves_pending_journal", verify_leaves_pending_journal },
+        { "discards_inactive_journal", discards_inactive_journal },
+        { "discards_truncated_journal", discards_truncated_journal },
+    };
+    int failed = 0;
+    for (auto& it : tests)
+    {
+        bool passed = it.run(e);
+        std::cout << (passed ? "OK     " : "FAILED ") << it.name << std::endl;
+        failed += passed ? 0 : 1;
+    }
+    std::filesystem::remove_all(directory());
+    return failed == 0 ? 0 : 1;
+}
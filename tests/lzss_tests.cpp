@@ -0,0 +1,210 @@
+// Round-trips data through lzss::compressor and lzss::decompressor and decodes hand-assembled streams.
+#include "lzss.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+    using bytes = std::vector<char>;
+
+    // Decompresses input, feeding it in pieces of input_step bytes and reading the output in pieces of output_step bytes.
+    // Returns false if the decompressor did not finish in a good state.
+    bool decompress(const bytes& input, size_t size, bytes& out_data, size_t input_step = 4096, size_t output_step = 1000)
+    {
+        size_t consumed = 0;
+        rv::util::lzss::decompressor unpacker(size, [&](char* arr, size_t count) -> size_t {
+            count = std::min({ count, input_step, input.size() - consumed });
+            std::memcpy(arr, input.data() + consumed, count);
+            consumed += count;
+            return count;
+        });
+        out_data.clear();
+        bytes chunk(output_step);
+        size_t read;
+        while ((read = unpacker.read(chunk.data(), chunk.size())) > 0)
+        {
+            out_data.insert(out_data.end(), chunk.begin(), chunk.begin() + std::streamoff(read));
+        }
+        return unpacker.good() && unpacker.done() && unpacker.tell() == size;
+    }
+    bool round_trips(const std::string& name, const bytes& data)
+    {
+        bytes packed;
+        rv::util::lzss::compressor().compress(data.data(), data.size(), packed);
+        // Large steps take the fast group path, single bytes of input force the token path
+        for (auto step : { size_t(64 * 1024), size_t(7), size_t(1) })
+        {
+            bytes unpacked;
+            if (!decompress(packed, data.size(), unpacked, step, step == 1 ? 3 : 1000) || unpacked != data)
+            {
+                std::cerr << "    " << name << " (" << data.size() << " bytes) failed with input steps of " << step << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    const size_t sizes[] = { 0, 1, 17, 143, 144, 145, 4095, 4096, 4097, 65535, 65536, 65537, 200000 };
+
+    bool round_trips_random()
+    {
+        std::mt19937 random(7);
+        for (auto size : sizes)
+        {
+            bytes data(size);
+            for (auto& c : data)
+            {
+                c = char(random());
+            }
+            if (!round_trips("random", data))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+    bool round_trips_repetitive()
+    {
+        std::mt19937 random(11);
+        const std::string phrase = "class CfgFunctions { tag = \"BIS\"; };\r\n";
+        for (auto size : sizes)
+        {
+            bytes zeros(size, '\0');
+            bytes spaces(size, ' ');
+            bytes text(size);
+            bytes runs(size);
+            for (size_t i = 0; i < size; i++)
+            {
+                text[i] = phrase[i % phrase.size()];
+                // Runs of random length and value, matching at short distances
+                runs[i] = i > 0 && random() % 8 != 0 ? runs[i - 1] : char(random() % 4);
+            }
+            if (!round_trips("zeros", zeros) || !round_trips("spaces", spaces) || !round_trips("text", text) || !round_trips("runs", runs))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bytes checksum_of(const std::string& text)
+    {
+        uint32_t sum = 0;
+        for (auto c : text)
+        {
+            sum += uint8_t(c);
+        }
+        return { char(sum & 0xFF), char((sum >> 8) & 0xFF), char((sum >> 16) & 0xFF), char((sum >> 24) & 0xFF) };
+    }
+    bool decodes(const bytes& stream, const std::string& expected)
+    {
+        for (auto step : { size_t(4096), size_t(1) })
+        {
+            bytes unpacked;
+            if (!decompress(stream, expected.size(), unpacked, step) || std::string(unpacked.begin(), unpacked.end()) != expected)
+            {
+                std::cerr << "    decoding \"" << expected << "\" failed with input steps of " << step << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+    // A distance of 0 refers to the oldest byte of the window, 4096 bytes back, which is a space at the start.
+    bool decodes_distance_zero()
+    {
+        // Pointer (distance 0, length 3), literal 'a'
+        bytes stream = { 0x02, 0x00, 0x00, 'a' };
+        auto sum = checksum_of("   a");
+        stream.insert(stream.end(), sum.begin(), sum.end());
+        return decodes(stream, "   a");
+    }
+    // Pointers reaching before the start of the output read spaces for the missing bytes.
+    bool decodes_reference_into_history()
+    {
+        // Literals 'x', 'y', pointer (distance 5, length 4)
+        bytes stream = { 0x03, 'x', 'y', 0x05, 0x01 };
+        auto sum = checksum_of("xy   x");
+        stream.insert(stream.end(), sum.begin(), sum.end());
+        return decodes(stream, "xy   x");
+    }
+    // Pointers shorter than their distance repeat the last bytes.
+    bool decodes_overlapping_run()
+    {
+        // Literal 'a', pointer (distance 1, length 18)
+        bytes stream = { 0x01, 'a', 0x01, 0x0F };
+        auto sum = checksum_of(std::string(19, 'a'));
+        stream.insert(stream.end(), sum.begin(), sum.end());
+        return decodes(stream, std::string(19, 'a'));
+    }
+    // Stream assembled by hand following the format, not by lzss::compressor,
+    // long enough for the first groups to take the fast path.
+    bool decodes_sample()
+    {
+        const unsigned char sample[] = {
+            0xFF, 0x63, 0x6C, 0x61, 0x73, 0x73, 0x20, 0x43, 0x66, 0xFF, 0x67, 0x50, 0x61, 0x74, 0x63, 0x68,
+            0x65, 0x73, 0xBF, 0x0D, 0x0A, 0x7B, 0x0D, 0x0A, 0x09, 0x16, 0x03, 0x41, 0xFF, 0x33, 0x5F, 0x46,
+            0x75, 0x6E, 0x63, 0x74, 0x69, 0x9F, 0x6F, 0x6E, 0x73, 0x5F, 0x46, 0x17, 0x00, 0x1B, 0x01, 0x09,
+            0xFF, 0x61, 0x75, 0x74, 0x68, 0x6F, 0x72, 0x20, 0x3D, 0xFF, 0x20, 0x22, 0x42, 0x6F, 0x68, 0x65,
+            0x6D, 0x69, 0xFF, 0x61, 0x20, 0x49, 0x6E, 0x74, 0x65, 0x72, 0x61, 0xDE, 0x28, 0x00, 0x76, 0x65,
+            0x22, 0x3B, 0x23, 0x01, 0x6E, 0x61, 0xFB, 0x6D, 0x65, 0x21, 0x01, 0x41, 0x72, 0x6D, 0x61, 0x20,
+            0xCF, 0x33, 0x20, 0x2D, 0x20, 0x47, 0x06, 0x20, 0x03, 0x72, 0x65, 0xFF, 0x71, 0x75, 0x69, 0x72,
+            0x65, 0x64, 0x41, 0x64, 0x6D, 0x64, 0x14, 0x00, 0x5B, 0x5D, 0x2C, 0x00, 0x7B, 0x22, 0x6E, 0x00,
+            0xFF, 0x44, 0x61, 0x74, 0x61, 0x5F, 0x46, 0x22, 0x7D, 0x9E, 0x25, 0x0A, 0x56, 0x65, 0x72, 0x73,
+            0x3B, 0x00, 0x24, 0x00, 0x30, 0x7B, 0x2E, 0x31, 0x1A, 0x02, 0x75, 0x6E, 0x69, 0x74, 0x36, 0x04,
+            0x1E, 0x2B, 0x03, 0x77, 0x65, 0x61, 0x70, 0x49, 0x06, 0x13, 0x02, 0x05, 0x01, 0x00, 0x04, 0x01,
+            0xD5, 0x41, 0x00, 0x00
+        };
+        const std::string expected =
+            "class CfgPatches\r\n{\r\n\tclass A3_Functions_F\r\n\t{\r\n\t\tauthor = \"Bohemia Interactive\";\r\n"
+            "\t\tname = \"Arma 3 - Functions\";\r\n\t\trequiredAddons[] = {\"A3_Data_F\"};\r\n\t\trequiredVersion = 0.1;\r\n"
+            "\t\tunits[] = {};\r\n\t\tweapons[] = {};\r\n\t};\r\n};\r\n";
+        return decodes(bytes(std::begin(sample), std::end(sample)), expected);
+    }
+    bool rejects_bad_checksum()
+    {
+        bytes stream = { 0x03, 'x', 'y', 0x05, 0x01, 0, 0, 0, 0 };
+        bytes unpacked;
+        return !decompress(stream, 6, unpacked);
+    }
+    bool rejects_truncated_input()
+    {
+        bytes packed;
+        bytes data(5000, 'q');
+        rv::util::lzss::compressor().compress(data.data(), data.size(), packed);
+        packed.resize(packed.size() / 2);
+        bytes unpacked;
+        return !decompress(packed, data.size(), unpacked);
+    }
+}
+
+int main()
+{
+    struct test
+    {
+        const char* name;
+        bool (*run)();
+    };
+    const test tests[] = {
+        { "round_trips_random", round_trips_random },
+        { "round_trips_repetitive", round_trips_repetitive },
+        { "decodes_distance_zero", decodes_distance_zero },
+        { "decodes_reference_into_history", decodes_reference_into_history },
+        { "decodes_overlapping_run", decodes_overlapping_run },
+        { "decodes_sample", decodes_sample },
+        { "rejects_bad_checksum", rejects_bad_checksum },
+        { "rejects_truncated_input", rejects_truncated_input },
+    };
+    int failed = 0;
+    for (auto& it : tests)
+    {
+        bool passed = it.run();
+        std::cout << (passed ? "OK     " : "FAILED ") << it.name << std::endl;
+        failed += passed ? 0 : 1;
+    }
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,256 @@
+// Builds small PBOs and checks how pbofile and its companions treat the names in them.
+#include "pbo.hpp"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace
+{
+    using contents = std::vector<std::pair<std::string, std::string>>;
+
+    std::filesystem::path directory()
+    {
+        auto path = std::filesystem::temp_directory_path() / "rvutil-pbo-tests";
+        std::filesystem::create_directories(path);
+        return path;
+    }
+    // Hands out data from memory, as pbo_builder::producer.
+    rv::util::pbo::pbo_builder::producer produce(const std::string& data)
+    {
+        auto produced = std::make_shared<size_t>(0);
+        return [data, produced](char* arr, size_t count) -> size_t {
+            count = std::min(count, data.size() - *produced);
+            std::memcpy(arr, data.data() + *produced, count);
+            *produced += count;
+            return count;
+        };
+    }
+    // Builds a PBO holding the provided files, in order.
+    bool build(const std::filesystem::path& path, const contents& files)
+    {
+        rv::util::pbo::pbo_builder builder;
+        for (auto& [name, data] : files)
+        {
+            if (!builder.add(name, data.size(), produce(data)))
+            {
+                return false;
+            }
+        }
+        return builder.build(path);
+    }
+    // Reads everything the reader provides.
+    bool read_all(rv::util::pbo::pbofile::reader& r, std::string& out_data)
+    {
+        out_data.resize(r.size());
+        size_t done = 0;
+        while (done < out_data.size())
+        {
+            auto bytes = r.read(out_data.data() + done, std::streamsize(out_data.size() - done));
+            if (bytes == 0)
+            {
+                return false;
+            }
+            done += bytes;
+        }
+        return r.good();
+    }
+    // Reads the contents of the provided file, false if it does not exist.
+    template<typename source>
+    bool read(const source& pbo, std::string_view name, std::string& out_data)
+    {
+        rv::util::pbo::pbofile::reader r;
+        return pbo.read(name, r) && read_all(r, out_data);
+    }
+    bool has_contents(const rv::util::pbo::pbofile& pbo, std::string_view name, std::string_view expected)
+    {
+        std::string data;
+        if (!read(pbo, name, data) || data != expected)
+        {
+            std::cerr << "    " << name << " does not hold \"" << expected << "\"" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Changes staged with a different case or separator apply to the file they were matched against.
+    bool applies_normalized_transaction()
+    {
+        auto path = directory() / "normalized-transaction.pbo";
+        if (!build(path, { { "a\\one", "one" }, { "a\\two", "two" }, { "b", "b" } }))
+        {
+            return false;
+        }
+        {
+            rv::util::pbo::pbofile pbo(path);
+            pbo.lookup(rv::util::pbo::lookup_mode::normalized);
+            rv::util::pbo::pbofile::transaction tx;
+            if (!pbo.begin(tx) || !tx.replace("A/ONE", "uno") || !tx.remove("A/TWO") || !tx.commit() || !pbo.seal())
+            {
+                std::cerr << "    staging or committing failed" << std::endl;
+                return false;
+            }
+        }
+        rv::util::pbo::pbofile pbo(path);
+        std::string removed;
+        if (pbo.files().size() != 2 || read(pbo, "a\\two", removed) || !pbo.verify())
+        {
+            std::cerr << "    a\\two was not removed" << std::endl;
+            return false;
+        }
+        return has_contents(pbo, "a\\one", "uno") && has_contents(pbo, "b", "b");
+    }
+    // Names that cannot be stored in the table are rejected up front, the PBO built stays intact.
+    bool builder_rejects_invalid_names()
+    {
+        auto source = directory() / "source.txt";
+        {
+            std::ofstream file(source, std::ios_base::binary);
+            file << "source";
+        }
+        rv::util::pbo::pbo_builder builder;
+        for (std::string_view name : { std::string_view(""), std::string_view("?"), std::string_view("????"), std::string_view("a\0b", 3) })
+        {
+            if (builder.add(name, 4, produce("data")) || builder.add(name, source))
+            {
+                std::cerr << "    accepted \"" << name << "\"" << std::endl;
+                return false;
+            }
+        }
+        auto path = directory() / "builder-names.pbo";
+        if (!builder.add("first", 5, produce("first")) || !builder.add("?x", 6, produce("second")) || !builder.build(path))
+        {
+            return false;
+        }
+        rv::util::pbo::pbofile pbo(path);
+        return pbo.verify() && pbo.files().size() == 2 && has_contents(pbo, "first", "first") && has_contents(pbo, "?x", "second");
+    }
+    // Files mapping to the same output path are extracted once, the first one wins.
+    bool extracts_duplicate_paths_once()
+    {
+        auto path = directory() / "duplicates.pbo";
+        if (!build(path, { { "dir\\File.txt", "first" }, { "DIR/file.txt", "second" }, { "dir\\.\\file.TXT", "third" }, { "other", "other" } }))
+        {
+            return false;
+        }
+        rv::util::pbo::pbofile pbo(path);
+        auto destination = directory() / "duplicates";
+        rv::util::pbo::extract_options options;
+        options.threads = 4;
+        rv::util::pbo::extract_statistics statistics;
+        if (!pbo.extract_all(destination, options, statistics) || statistics.files != 2 || statistics.duplicates != 2)
+        {
+            std::cerr << "    extracted " << statistics.files << " files, skipped " << statistics.duplicates << std::endl;
+            return false;
+        }
+        size_t found = 0;
+        for (auto& it : std::filesystem::recursive_directory_iterator(destination))
+        {
+            found += it.is_regular_file() ? 1 : 0;
+        }
+        std::ifstream file(destination / "dir" / "File.txt", std::ios_base::binary);
+        std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        return found == 2 && data == "first";
+    }
+    // Names released by reclaim() are moved, everything still has to be found under its name afterwards.
+    bool keeps_names_when_compacting()
+    {
+        auto path = directory() / "compact.pbo";
+        if (!build(path, { { "a", "a" }, { "b", "b" }, { "c", "c" } }))
+        {
+            return false;
+        }
+        rv::util::pbo::pbofile pbo(path);
+        std::string latest;
+        for (int i = 0; i < 50; i++)
+        {
+            latest = "content " + std::to_string(i);
+            rv::util::pbo::pbofile::writer w;
+            if (!pbo.attribute("version", std::to_string(i)) || !pbo.write("b", w))
+            {
+                return false;
+            }
+            w.write(latest.data(), std::streamsize(latest.size()));
+            w.close();
+        }
+        size_t reclaimed;
+        (void)pbo.reclaim(reclaimed);
+        auto attributes = pbo.attributes();
+        if (attributes.size() != 1 || attributes[0].first != "version" || attributes[0].second != "49")
+        {
+            std::cerr << "    attribute lost" << std::endl;
+            return false;
+        }
+        return has_contents(pbo, "a", "a") && has_contents(pbo, "b", latest) && has_contents(pbo, "c", "c")
+            && pbo.defragment() && has_contents(pbo, "b", latest) && pbo.files().size() == 3;
+    }
+    // Within a PBO, the vfs resolves duplicates to the first entry like pbofile does,
+    // also for entries only matching once the leading backslash is ignored.
+    // Across PBOs, priority decides, the one mounted last winning on equal priority.
+    bool vfs_resolves_duplicates_like_pbofile()
+    {
+        auto first = directory() / "vfs-first.pbo";
+        auto second = directory() / "vfs-second.pbo";
+        if (!build(first, { { "a", "first a" }, { "b", "first b" }, { "\\a", "shadowed a" }, { "a", "shadowed a" } })
+            || !build(second, { { "b", "second b" }, { "b", "shadowed b" } }))
+        {
+            return false;
+        }
+        rv::util::pbo::pbo_vfs single;
+        rv::util::pbo::pbofile pbo(first);
+        std::string direct;
+        std::string resolved;
+        if (!single.mount(first) || !read(pbo, "a", direct) || !read(single, "a", resolved))
+        {
+            return false;
+        }
+        if (direct != "first a" || resolved != direct)
+        {
+            std::cerr << "    vfs resolved \"" << resolved << "\", pbofile \"" << direct << "\"" << std::endl;
+            return false;
+        }
+
+        rv::util::pbo::pbo_vfs both;
+        if (!both.mount(first) || !both.mount(second) || !read(both, "b", resolved))
+        {
+            return false;
+        }
+        if (resolved != "second b")
+        {
+            std::cerr << "    vfs resolved \"" << resolved << "\" across PBOs" << std::endl;
+            return false;
+        }
+        return both.size() == 2;
+    }
+}
+
+int main()
+{
+    struct test
+    {
+        const char* name;
+        bool (*run)();
+    };
+    const test tests[] = {
+        { "applies_normalized_transaction", applies_normalized_transaction },
+        { "builder_rejects_invalid_names", builder_rejects_invalid_names },
+        { "extracts_duplicate_paths_once", extracts_duplicate_paths_once },
+        { "keeps_names_when_compacting", keeps_names_when_compacting },
+        { "vfs_resolves_duplicates_like_pbofile", vfs_resolves_duplicates_like_pbofile },
+    };
+    int failed = 0;
+    for (auto& it : tests)
+    {
+        bool passed = it.run();
+        std::cout << (passed ? "OK     " : "FAILED ") << it.name << std::endl;
+        failed += passed ? 0 : 1;
+    }
+    std::filesystem::remove_all(directory());
+    return failed == 0 ? 0 : 1;
+}